@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+#include <vector>
+
+#include "vm.hpp"
+
+using namespace vm::runtime;
+using namespace vm::memory;
+
+static void BM_CreateGarbage(benchmark::State &state)
+{
+    Allocator allocator;
+    int value = 42;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(allocator.create(Type::I32, reinterpret_cast<byte *>(&value), sizeof(int)));
+    }
+}
+BENCHMARK(BM_CreateGarbage);
+
+// Keeps a fraction of the objects alive so every collection has to compact survivors
+static void BM_CreateCollect(benchmark::State &state)
+{
+    std::size_t live_every = state.range(0);
+    std::vector<Object *> live;
+    int value = 42;
+    for (auto _ : state)
+    {
+        Allocator allocator;
+        for (std::size_t i = 0; i < 100000; ++i)
+        {
+            Object *obj = allocator.create(Type::I32, reinterpret_cast<byte *>(&value), sizeof(int));
+            if (i % live_every == 0)
+            {
+                obj->links++;
+                live.push_back(obj);
+            }
+        }
+        state.PauseTiming();
+        for (Object *obj : live)
+            obj->links--;
+        live.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * 100000);
+}
+BENCHMARK(BM_CreateCollect)->Arg(2)->Arg(16)->Arg(1024);
+
+static void BM_CreateArray(benchmark::State &state)
+{
+    Allocator allocator;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(allocator.create(Type::ARRAY, nullptr, state.range(0)));
+    }
+}
+BENCHMARK(BM_CreateArray)->Arg(16)->Arg(4096);
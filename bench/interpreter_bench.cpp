@@ -0,0 +1,29 @@
+#include <benchmark/benchmark.h>
+#include <limits>
+#include <memory>
+
+#include "vm.hpp"
+#include "workloads.hpp"
+
+// The JIT threshold is disabled so these measure the interpreter alone
+static void BM_Interpret(benchmark::State &state, const char *name)
+{
+    std::filesystem::path path = bench::write_workload(name, {{"n", state.range(0)}});
+    std::unique_ptr<bench::LoadedProgram> program;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        program = std::make_unique<bench::LoadedProgram>(path);
+        program->env.jit_threshold = std::numeric_limits<std::size_t>::max();
+        state.ResumeTiming();
+
+        program->run();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_CAPTURE(BM_Interpret, fib, "fibonacci")->Arg(15)->Arg(20)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Interpret, loop, "sum_loop")->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Interpret, array_fill, "array_fill")->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Interpret, string_concat, "string_concat")->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Interpret, call_depth, "call_depth")->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
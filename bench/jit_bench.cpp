@@ -0,0 +1,36 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+
+#include "vm.hpp"
+#include "workloads.hpp"
+
+// Cost of generating, compiling and loading one function
+static void BM_CompileFunction(benchmark::State &state)
+{
+    std::filesystem::path path = bench::write_workload("fibonacci", {{"n", 0}});
+    bench::LoadedProgram program(path);
+    for (auto _ : state)
+    {
+        vm::code::Function &function = program.env.functions.functions[0];
+        program.reader.set_offset(function.offset);
+        vm::jit::compile_func(program.reader, 0, function, false);
+        benchmark::DoNotOptimize(function.compiled.load());
+    }
+}
+BENCHMARK(BM_CompileFunction)->Iterations(3)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// A full run of a program whose hot function tiers up, so compilation is amortized over the workload
+static void BM_TierUp(benchmark::State &state)
+{
+    std::filesystem::path path = bench::write_workload("fibonacci", {{"n", state.range(0)}});
+    std::unique_ptr<bench::LoadedProgram> program;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        program = std::make_unique<bench::LoadedProgram>(path);
+        state.ResumeTiming();
+
+        program->run();
+    }
+}
+BENCHMARK(BM_TierUp)->Arg(20)->Arg(25)->Iterations(3)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+#include <string>
+
+#include "vm.hpp"
+
+using namespace vm::runtime;
+
+static Object create_int(int value)
+{
+    return {Type::I32, reinterpret_cast<byte *>(&value), sizeof(int)};
+}
+
+static void BM_FormatInt(benchmark::State &state)
+{
+    Object obj = create_int(-1234567);
+    std::string buffer;
+    for (auto _ : state)
+    {
+        buffer.clear();
+        obj.format(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+}
+BENCHMARK(BM_FormatInt);
+
+static void BM_StringConversion(benchmark::State &state)
+{
+    std::string text(state.range(0), 's');
+    Object obj(Type::STRING, reinterpret_cast<const byte *>(text.data()), text.size());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(static_cast<std::string>(obj));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_StringConversion)->Arg(8)->Arg(1024);
+
+static void BM_FormatArray(benchmark::State &state)
+{
+    Object array(Type::ARRAY, nullptr, state.range(0));
+    Object element = create_int(7);
+    Object *pointer = &element;
+    for (long i = 0; i < state.range(0); ++i)
+    {
+        reinterpret_cast<Link *>(array.data)[i] = pointer;
+    }
+    std::string buffer;
+    for (auto _ : state)
+    {
+        buffer.clear();
+        array.format(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FormatArray)->Arg(16)->Arg(4096);
+
+static void BM_IntConversion(benchmark::State &state)
+{
+    Object obj = create_int(99);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(static_cast<int>(obj));
+        benchmark::DoNotOptimize(static_cast<bool>(obj));
+    }
+}
+BENCHMARK(BM_IntConversion);
+
+static void BM_Compare(benchmark::State &state)
+{
+    Object left = create_int(10), right = create_int(20);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(left < right);
+        benchmark::DoNotOptimize(left == right);
+    }
+}
+BENCHMARK(BM_Compare);
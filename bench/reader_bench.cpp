@@ -0,0 +1,52 @@
+#include <benchmark/benchmark.h>
+
+#include "vm.hpp"
+#include "workloads.hpp"
+
+using namespace vm::code;
+
+static void BM_ReadProgram(benchmark::State &state)
+{
+    std::filesystem::path path = bench::write_workload("sum_loop", {{"n", 1000}});
+    for (auto _ : state)
+    {
+        Reader reader(path);
+        vm::memory::Allocator allocator;
+        vm::Environment env = vm::load(reader, allocator);
+        benchmark::DoNotOptimize(env.functions.functions);
+    }
+}
+BENCHMARK(BM_ReadProgram);
+
+static void BM_ReadBytes(benchmark::State &state)
+{
+    std::filesystem::path path = bench::write_workload("array_fill", {{"n", state.range(0)}});
+    std::size_t size = std::filesystem::file_size(path);
+    for (auto _ : state)
+    {
+        Reader reader(path);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            benchmark::DoNotOptimize(reader.read_byte());
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_ReadBytes)->Arg(100);
+
+static void BM_ReadSeek(benchmark::State &state)
+{
+    std::filesystem::path path = bench::write_workload("sum_loop", {{"n", 1000}});
+    Reader reader(path);
+    Header header = reader.read_header();
+    benchmark::DoNotOptimize(header);
+    reader.read_constants();
+    reader.read_globals();
+    FunctionTable functions = reader.read_functions();
+    for (auto _ : state)
+    {
+        reader.set_offset(functions.functions[0].offset);
+        benchmark::DoNotOptimize(reader.read_16());
+    }
+}
+BENCHMARK(BM_ReadSeek);
@@ -0,0 +1,40 @@
+#ifndef SHELLVM_BENCH_WORKLOADS
+#define SHELLVM_BENCH_WORKLOADS
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vm.hpp"
+
+namespace bench
+{
+    // Generates and assembles a workload from src/workload.cpp into a temporary bytecode file
+    inline std::filesystem::path write_workload(const std::string &name, const vm::workload::Parameters &parameters)
+    {
+        std::vector<byte> bytes = vm::code::assemble(vm::workload::generate(name, parameters));
+        std::filesystem::path path = std::filesystem::temp_directory_path() / ("shellvm_bench_" + name + ".slime");
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+        return path;
+    }
+
+    struct LoadedProgram
+    {
+        vm::code::Reader reader;
+        vm::memory::Allocator allocator;
+        vm::Environment env;
+        u32 length;
+
+        LoadedProgram(const std::filesystem::path &path)
+            : reader(path), env(vm::load(reader, allocator)), length(reader.read_32()) {}
+
+        void run()
+        {
+            vm::process(reader, env, length, 0, false);
+        }
+    };
+}
+
+#endif
@@ -4,9 +4,21 @@
 #include <fstream>
 #include <filesystem>
 #include <functional>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <stack>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <unordered_map>
+#include <variant>
 
 namespace fs = std::filesystem;
 
@@ -35,17 +47,39 @@ namespace vm
             I32 = 0x01,
             USIZE = 0x02,
             STRING = 0x03,
-            ARRAY = 0x04
+            ARRAY = 0x04,
+            MAP = 0x05
         };
 
+        class Map;
+
+        // Element buffers of arrays come zeroed, which is an empty Link or a 0 element. From
+        // LARGE_ARRAY_BYTES on they are anonymous mappings, so only the pages written to take memory,
+        // and freeing one returns all of it to the OS
+        constexpr std::size_t LARGE_ARRAY_BYTES = 64 * 1024;
+        byte *allocate_elements(std::size_t bytes);
+        void free_elements(byte *, std::size_t bytes);
+
         struct Object
         {
             Type type;
+            // Set on strings built by concatenation. Their buffer holds capacity() bytes and appends
+            // grow it in place, so constants and other strings are never changed
+            bool growable = false;
+            // Set on the strings of a StringTable, two different interned strings are never equal
+            bool interned = false;
+            // I32 or USIZE for typed arrays, whose data holds raw 4 byte elements, VOID for arrays of links
+            Type element = Type::VOID;
+            // Bytecode offset of the instruction that allocated the object, fits in the padding after type
+            u32 site = 0;
             byte *data;
             std::size_t data_size;
             std::size_t links;
 
-            Object(Type, const byte *, std::size_t);
+            // A MAP starts empty, data points to its Map and data_size counts its entries
+            Object(Type, const byte *, std::size_t, bool growable = false);
+            // Array of size elements, zeroed when they are raw values and empty links otherwise
+            Object(std::size_t size, Type element);
             Object(const Object &) = delete;
             Object(Object &&) = delete;
 
@@ -54,6 +88,9 @@ namespace vm
 
             bool operator==(const Object &) const;
             bool operator!=(const Object &) const;
+            // Negative, zero or positive as the string is ordered before, equal to or after the other one,
+            // both must be strings
+            int compare(const Object &) const;
 
             bool operator<=(const Object &) const;
             bool operator>=(const Object &) const;
@@ -65,6 +102,15 @@ namespace vm
             explicit operator u32() const;
             explicit operator std::string() const;
 
+            void format(std::string &) const;
+
+            // Bytes allocated for data, a power of two for growable strings
+            std::size_t capacity() const;
+            // Appends to a growable string, doubling the buffer when it is full
+            void append(const byte *, std::size_t);
+
+            Map &map() const;
+
             ~Object();
         };
 
@@ -98,6 +144,78 @@ namespace vm
             ~GlobalVariables();
         };
 
+        // The interned strings of an isolate: equal strings share one object, so comparing two of them
+        // is a pointer compare. The map caches the hash of every key
+        class StringTable
+        {
+        public:
+            StringTable() = default;
+            StringTable(const StringTable &) = delete;
+            StringTable(StringTable &&) = default;
+
+            StringTable &operator=(const StringTable &) = delete;
+            StringTable &operator=(StringTable &&) = delete;
+
+            // The interned string with these bytes, nullptr when there is none
+            Object *find(std::string_view) const;
+            // Interns a string that never changes, unless an equal one is interned already. The table
+            // links to its strings, so they are never collected
+            Object *add(Object *);
+            std::size_t size() const;
+
+        private:
+            std::unordered_map<std::string_view, Link> strings;
+        };
+
+        // Hash map with open addressing. Slots are probed in groups of 16 whose control bytes hold 7 bits
+        // of the hash of their key, so one SIMD comparison skips most slots of a group without touching
+        // their keys. Numbers and strings are keys by value, arrays and maps by identity. Every slot
+        // caches the hash of its key, which spares hashing strings again when the map grows
+        class Map
+        {
+        public:
+            Map() = default;
+            Map(const Map &) = delete;
+            Map &operator=(const Map &) = delete;
+            ~Map();
+
+            // The value of the key, nullptr when it is missing
+            Object *find(const Object *key) const;
+            // Adds the key or replaces its value, the map links both
+            void put(Object *key, Object *value);
+            bool remove(const Object *key);
+            std::size_t size() const;
+            std::size_t bytes() const;
+            // Forgets every entry without unlinking, for an owner that frees all objects at once
+            void release();
+
+            // Slots are visited by index: the first occupied slot from index on, slots() when there is none
+            std::size_t next(std::size_t index) const;
+            std::size_t slots() const;
+            Object *key(std::size_t slot) const;
+            Object *value(std::size_t slot) const;
+
+            static std::size_t hash(const Object *key);
+
+        private:
+            struct Slot
+            {
+                Link key;
+                Link value;
+                std::size_t hash = 0;
+            };
+
+            // Slot of the key, or the first free slot of its probe sequence with found set to false
+            std::size_t locate(const Object *key, std::size_t hash, bool &found) const;
+            void rehash(std::size_t capacity);
+
+            byte *control = nullptr;
+            Slot *entries = nullptr;
+            std::size_t capacity = 0;
+            std::size_t count = 0;
+            std::size_t tombstones = 0;
+        };
+
     }
 
     namespace memory
@@ -113,16 +231,49 @@ namespace vm
             Allocator &operator=(const Allocator &) = delete;
             Allocator &operator=(Allocator &&) = delete;
 
-            runtime::Object *create(runtime::Type, const byte *, std::size_t);
+            struct SiteCounter
+            {
+                std::size_t allocations = 0;
+                std::size_t bytes = 0;
+            };
+
+            struct Statistics
+            {
+                std::size_t allocations = 0;
+                std::size_t collections = 0;
+                std::chrono::nanoseconds collection_time{0};
+                std::chrono::nanoseconds longest_collection{0};
+            };
+
+            runtime::Object *create(runtime::Type, const byte *, std::size_t, bool growable = false);
+            // Typed array for I32 and USIZE elements, array of links for any other element type
+            runtime::Object *create_array(std::size_t size, runtime::Type element);
+            // Makes room for count more objects, so creating them does not collect garbage
+            void reserve(std::size_t count);
 
             std::size_t size() const;
 
+            const Statistics &statistics() const;
+            void reset_statistics();
+
+            // Counts allocations per site while enabled, sites are stamped on objects either way
+            void track_sites(bool);
+            const std::map<u32, SiteCounter> &site_counters() const;
+            const std::vector<runtime::Object *> &objects() const;
+
+            // Set by the interpreter before every instruction
+            u32 site = 0;
+
             ~Allocator();
 
         private:
             std::vector<runtime::Object *> allocated_objects;
+            Statistics totals;
+            bool tracking_sites = false;
+            std::map<u32, SiteCounter> sites;
 
             void collect_garbage();
+            runtime::Object *adopt(runtime::Object *);
         };
 
     }
@@ -205,13 +356,21 @@ namespace vm
 
         struct Function
         {
+            std::string name;
             std::size_t offset;
             runtime::Type return_type;
             byte arg_count;
             u16 local_count;
             u32 length;
-            std::size_t calls = 0;
-            void *compiled = nullptr;
+            // Shared by every Environment of an image, published once under Image::jit_mutex. Debug builds
+            // trace into Environment::tracer, so they are kept apart from the code of normal runs
+            std::atomic<void *> compiled{nullptr};
+            std::atomic<void *> compiled_debug{nullptr};
+
+            std::atomic<void *> &compiled_code(bool debug_mode)
+            {
+                return debug_mode ? compiled_debug : compiled;
+            }
         };
 
         struct FunctionTable
@@ -251,10 +410,21 @@ namespace vm
             ~IntrinsicTable();
         };
 
+        const char *command_name(byte);
+
+        class Reader;
+
+        // Translates the textual form of a program to bytecode and back,
+        // the syntax is described in README.md
+        std::vector<byte> assemble(std::string_view);
+        void disassemble(Reader &, std::ostream &);
+
         class Reader
         {
         public:
             Reader(const fs::path &);
+            // Reads from bytes kept in memory, readers over the same bytes are independent cursors
+            Reader(std::shared_ptr<const std::vector<byte>>);
             Reader(const Reader &) = delete;
             Reader(Reader &&);
             Reader &operator=(const Reader &) = delete;
@@ -284,6 +454,7 @@ namespace vm
             constexpr static std::size_t DEFAULT_BUFFER_SIZE = 1024;
 
             std::ifstream _input;
+            std::shared_ptr<const std::vector<byte>> _image;
             byte *_buffer;
             std::size_t _capacity;
             std::size_t _limit;
@@ -298,32 +469,543 @@ namespace vm
 
     }
 
+    namespace debug
+    {
+        class Tracer;
+    }
+
+    // Decoded program, immutable after loading except for the JIT output of its
+    // functions, shared by every Environment created from it
+    struct Image
+    {
+        std::shared_ptr<const std::vector<byte>> bytes;
+        code::Header header;
+        code::ConstantPool constant_pool;
+        u16 global_count;
+        code::FunctionTable functions;
+        code::IntrinsicTable intrinsics;
+        std::size_t body_offset;
+        u32 body_length;
+        std::mutex jit_mutex;
+        // Native code of the main body, set when an ahead-of-time compiled library is loaded
+        void *compiled_main = nullptr;
+
+        Image(std::shared_ptr<const std::vector<byte>> bytes,
+              code::Header header,
+              code::ConstantPool &&constant_pool,
+              u16 global_count,
+              code::FunctionTable &&functions,
+              code::IntrinsicTable &&intrinsics,
+              std::size_t body_offset,
+              u32 body_length);
+
+        // A cursor of its own over the bytes of the image
+        code::Reader reader() const;
+    };
+
+    // Execution state of one isolate, an Environment is used by one thread at a time
+    // while any number of them run the same image concurrently
     struct Environment
     {
+        std::shared_ptr<Image> image;
         memory::Allocator allocator;
         code::Header header;
         code::ConstantPool constant_pool;
         runtime::GlobalVariables global;
-        code::FunctionTable functions;
-        code::IntrinsicTable intrinsics;
+        // String constants are interned when the isolate is created, other strings by the intern intrinsic
+        runtime::StringTable strings;
+        code::FunctionTable &functions;
+        const code::IntrinsicTable &intrinsics;
+        std::vector<std::size_t> calls;
         std::stack<runtime::Object *> stack;
+        std::string buffer;
+        // Where println writes, std::cout unless the embedder redirects it
+        std::ostream *output;
+        debug::Tracer *tracer = nullptr;
+        std::size_t jit_threshold = 100;
+        // Object in the variable that the instruction after the current ADD stores into. When that
+        // variable holds the only other link, string concatenation appends to the left operand in place
+        runtime::Object *overwritten = nullptr;
+        // Makes the snapshot intrinsic stop the program instead of doing nothing
+        bool stop_at_snapshot = false;
+
+        explicit Environment(std::shared_ptr<Image>, memory::Allocator = {});
+    };
+
+    namespace debug
+    {
+
+        struct TraceRecord
+        {
+            std::size_t offset;
+            byte command;
+            u32 operand;
+            std::size_t stack_size;
+            runtime::Type top_type;
+            std::int64_t top_value;
+        };
+
+        // Collects trace records from the interpreter thread into a single-producer
+        // single-consumer ring buffer, a background thread writes them to the stream
+        class Tracer
+        {
+        public:
+            Tracer(std::ostream &);
+            Tracer(const Tracer &) = delete;
+            Tracer(Tracer &&) = delete;
+
+            Tracer &operator=(const Tracer &) = delete;
+            Tracer &operator=(Tracer &&) = delete;
+
+            void record(const TraceRecord &);
+            void flush();
+
+            ~Tracer();
+
+        private:
+            constexpr static std::size_t CAPACITY = 4096;
+
+            std::unique_ptr<TraceRecord[]> records;
+            alignas(64) std::atomic<std::size_t> head;
+            alignas(64) std::atomic<std::size_t> tail;
+            std::atomic<bool> running;
+            std::ostream &output;
+            std::thread writer;
+
+            void write_records();
+        };
+
+        void trace(Environment &, std::size_t, byte, u32);
+
+    }
+
+    namespace profile
+    {
+
+        constexpr u16 MAIN_BODY = 0xFFFF;
+
+        // Pushes a frame on the shadow call stack of the current thread for the
+        // lifetime of a SnailL call, interpreted frames read their offset from the reader
+        class CallGuard
+        {
+        public:
+            CallGuard(u16 function, const code::Reader *reader, std::size_t entry, std::size_t call_site);
+            CallGuard(const CallGuard &) = delete;
+            CallGuard(CallGuard &&) = delete;
+
+            CallGuard &operator=(const CallGuard &) = delete;
+            CallGuard &operator=(CallGuard &&) = delete;
+
+            ~CallGuard();
+        };
+
+        void start(unsigned frequency);
+        void stop();
+        void write_collapsed(std::ostream &, const code::FunctionTable &);
+
+    }
 
-        Environment(
-            memory::Allocator &allocator,
-            code::Header &&header,
-            code::ConstantPool &&pool,
-            runtime::GlobalVariables &&global,
-            code::FunctionTable &&functions,
-            code::IntrinsicTable &&intrinsics);
+    struct Options
+    {
+        bool debug_mode = false;
+        fs::path profile_output;
+        unsigned profile_frequency = 99;
+        bool perf_map = false;
+        bool jitdump = false;
+        unsigned bench_runs = 0;
+        unsigned bench_warmup = 3;
+        bool bench_reset_jit = false;
+        fs::path stats_output;
+        fs::path heap_profile;
+        bool phase_counters = false;
+        unsigned isolates = 1;
+        fs::path batch_jobs;
+        // Worker threads of --batch, 0 for one per hardware thread
+        unsigned batch_workers = 0;
+        fs::path serve_socket;
+        fs::path connect_socket;
+        fs::path snapshot_output;
+        fs::path snapshot_input;
+        fs::path native_library;
     };
 
+    Environment load(code::Reader &, memory::Allocator &);
+
+    std::shared_ptr<Image> load_image(const fs::path &);
+    std::shared_ptr<Image> load_image(std::vector<byte>);
+
+    // FNV-1a of the bytes of a program, identifies the program an artifact was built from
+    std::uint64_t content_hash(const std::vector<byte> &);
+
+    // Runs the main body of the image of env, from resume_offset when it is not 0
+    void run(Environment &, bool debug_mode, std::size_t resume_offset = 0);
+
+    // Calls a function with its arguments already on the stack, like the CALL instruction does
+    void call(Environment &, code::Reader &, u16 function, bool debug_mode);
+
     void process(const fs::path &, bool);
 
+    void process(const fs::path &, const Options &);
+
     void process(code::Reader &reader, Environment &env, std::size_t, std::size_t, bool);
 
+    namespace stats
+    {
+
+        // Every counter is written by a single thread with relaxed loads and
+        // stores, which keeps increments cheap and reads from a dump race free
+        using Counter = std::atomic<std::uint64_t>;
+
+        inline void add(Counter &counter, std::uint64_t value = 1)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        // Bucket i counts durations below 2^i nanoseconds
+        struct Histogram
+        {
+            static constexpr std::size_t BUCKETS = 48;
+
+            Counter buckets[BUCKETS]{};
+            Counter count{0};
+            Counter sum{0};
+            Counter max{0};
+
+            void record(std::chrono::nanoseconds);
+        };
+
+        struct Counters
+        {
+            Counter instructions{0};
+            Counter calls{0};
+            Counter allocations{0};
+            Counter collections{0};
+            Counter objects_freed{0};
+            // Compiler runs, each one building a batch of jit_functions functions
+            Counter jit_compilations{0};
+            Counter jit_functions{0};
+            Counter jit_failures{0};
+            Histogram gc_pause;
+            Histogram jit_compile;
+        };
+
+        // Counters of the calling thread, added to the totals of exited threads when it exits
+        Counters &local();
+
+        // Sums the counters of all threads, "-" writes to stderr
+        void write_json(std::ostream &);
+        void write_json(const fs::path &);
+
+        // Rewrites the file with the current totals whenever the process receives SIGUSR1
+        void dump_on_signal(const fs::path &);
+        void stop_dump_on_signal();
+
+    }
+
+    namespace phases
+    {
+
+        enum Phase : std::size_t
+        {
+            LOAD,
+            INTERPRET,
+            JIT_COMPILE,
+            GC,
+            PHASES
+        };
+
+        // Attributes cycles, instructions, cache misses, branch misses and wall time to
+        // the innermost open phase of the calling thread, a no-op until enable() is called on it
+        class Scope
+        {
+        public:
+            explicit Scope(Phase);
+            Scope(const Scope &) = delete;
+            Scope(Scope &&) = delete;
+
+            Scope &operator=(const Scope &) = delete;
+            Scope &operator=(Scope &&) = delete;
+
+            ~Scope();
+
+        private:
+            bool active;
+        };
+
+        // Opens a perf_event_open counter group for the calling thread, false when
+        // hardware counters are unavailable and only wall time is measured
+        bool enable();
+        void write_report(std::ostream &);
+
+    }
+
+    namespace heap
+    {
+
+        // Bytes owned by an object, including its header
+        std::size_t footprint(const runtime::Object &);
+
+        // Writes allocation sites counted by the allocator and the live objects,
+        // those with links, grouped by type and by site as JSON
+        void write_snapshot(std::ostream &, const Environment &);
+
+    }
+
+    namespace measure
+    {
+
+        struct Run
+        {
+            std::chrono::nanoseconds wall_time;
+            std::size_t instructions;
+            std::size_t allocations;
+            std::size_t collections;
+            std::chrono::nanoseconds collection_time;
+            std::chrono::nanoseconds longest_collection;
+        };
+
+        struct Report
+        {
+            unsigned warmup;
+            bool reset_jit;
+            std::vector<Run> runs;
+        };
+
+        // Loads the program once and runs its main body warmup + runs times,
+        // the output of the program is discarded
+        Report run(const fs::path &, const Options &);
+        void write_report(std::ostream &, const Report &);
+
+    }
+
+    namespace batch
+    {
+
+        // Loaded images by path, an image is loaded again when the content hash of its file changes
+        class ImageCache
+        {
+        public:
+            std::shared_ptr<Image> get(const fs::path &);
+
+            std::size_t loads() const;
+            std::size_t hits() const;
+
+        private:
+            mutable std::mutex mutex;
+            std::map<std::pair<std::string, std::uint64_t>, std::shared_ptr<Image>> images;
+            std::size_t load_count = 0;
+            std::size_t hit_count = 0;
+        };
+
+        struct Job
+        {
+            fs::path file;
+            std::string output;
+            // Empty when the job finished normally
+            std::string error;
+            std::chrono::nanoseconds wall_time{0};
+        };
+
+        struct Summary
+        {
+            std::vector<Job> jobs;
+            unsigned workers;
+            std::chrono::nanoseconds wall_time;
+            std::size_t images_loaded;
+            std::size_t image_cache_hits;
+            std::size_t steals;
+        };
+
+        // One program per line, relative to the jobs file, empty lines and lines starting with # are skipped
+        std::vector<fs::path> read_jobs(const fs::path &);
+
+        // Runs every job in an isolate of its own on a work-stealing pool of workers threads
+        Summary run(const std::vector<fs::path> &, unsigned workers, bool debug_mode);
+        void write_outputs(std::ostream &output, std::ostream &errors, const Summary &);
+        void write_summary(std::ostream &, const Summary &);
+
+    }
+
+    namespace server
+    {
+
+        // Keeps images and their JIT output across requests, every request runs in an isolate of its own
+        class Server
+        {
+        public:
+            explicit Server(const fs::path &socket);
+            Server(const Server &) = delete;
+            ~Server();
+
+            std::shared_ptr<Image> preload(const fs::path &);
+            // Serves clients until stop, then waits for the requests in flight
+            void run();
+            // Async-signal-safe
+            void stop();
+
+            const batch::ImageCache &image_cache() const;
+
+        private:
+            void serve_client(int);
+
+            fs::path path;
+            int listener = -1;
+            int stop_pipe[2] = {-1, -1};
+            batch::ImageCache images;
+            std::mutex mutex;
+            std::condition_variable idle;
+            std::size_t active = 0;
+        };
+
+        // Runs program on the server listening on socket and streams its output, returns the exit status
+        int request(const fs::path &socket, const fs::path &program, bool debug_mode, std::ostream &output, std::ostream &errors);
+
+    }
+
+    namespace snapshot
+    {
+
+        // Thrown by the snapshot intrinsic when Environment::stop_at_snapshot is set
+        struct Point
+        {
+        };
+
+        // Runs the main body up to its snapshot intrinsic, or to its end when it has none,
+        // and writes the globals and the heap reachable from them to the file
+        void create(const fs::path &, Environment &, bool debug_mode);
+        // Restores a snapshot of the program of env, returns the offset to resume the main body from
+        std::size_t restore(const fs::path &, Environment &);
+
+    }
+
+    namespace embed
+    {
+
+        // Values passed between the host and SnailL, arrays stay inside the VM
+        using Value = std::variant<std::monostate, int, u32, std::string>;
+
+        // A program loaded for calls from C++, its environment lives as long as the instance
+        // so globals and compiled functions persist between calls
+        class Instance
+        {
+        public:
+            explicit Instance(std::shared_ptr<Image>);
+            explicit Instance(const fs::path &);
+
+            // Runs the main body once, for programs whose globals are set up there
+            void run_main();
+
+            // Index of the function, std::out_of_range when the program has none by that name
+            u16 function(std::string_view name) const;
+            Value call(u16 function, const std::vector<Value> &arguments = {});
+            Value call(std::string_view name, const std::vector<Value> &arguments = {});
+
+            Environment &environment();
+
+        private:
+            Environment env;
+            code::Reader reader;
+            std::map<std::string, u16, std::less<>> names;
+        };
+
+    }
+
     namespace jit
     {
-        void compile_func(code::Reader &, int, code::Function &, bool);
+        // Debug builds report their progress to the stream when one is given
+        void compile_func(code::Reader &, int, code::Function &, bool, std::ostream * = nullptr);
+        // Compiles the functions with the given indexes into one shared object, calls between them are direct
+        void compile_batch(code::Reader &, code::FunctionTable &, const std::vector<u16> &, bool, std::ostream * = nullptr);
+        // Functions compiled together with the one that got hot: its callees that have run and every
+        // function past half of the threshold, at most BATCH_LIMIT of them and none compiled yet in that mode
+        std::vector<u16> select_batch(Environment &, code::Reader &, u16, bool);
+        constexpr std::size_t BATCH_LIMIT = 16;
+
+        // Compiled code of the function, compiling its batch first when no isolate has done so yet
+        void *compiled(Environment &, code::Reader &, u16, bool);
+
+        // Compiles every function and the main body of the image into one shared library
+        void compile_program(const Image &, const fs::path &library);
+        // Uses the code of a library made by compile_program for the image. A library built from
+        // other bytecode is not loaded, a warning is written and the image stays interpreted
+        bool load_program(Image &, const fs::path &library, std::ostream &warnings);
+    }
+
+    namespace ranges
+    {
+        // Counted loop whose accesses to array[index] stay in bounds:
+        //
+        //     header: PUSH_LOCAL index, bound, LT, JMP_IF_FALSE past the latch
+        //             ... array[index] ... index = index + step ...
+        //     latch:  JMP header
+        //
+        // It is innermost and only entered through its header. With array_length(array) as the bound the
+        // header itself checks every index. A constant or local bound needs the hoisted check
+        // proccess::loop_in_bounds when the loop is entered, the loop then stores nothing into the array
+        // and the bound and only adds the constant step to the index
+        struct Loop
+        {
+            std::size_t header;
+            std::size_t latch;
+            u16 index = 0;
+            u16 array = 0;
+            // INTRINSIC_CALL of array_length(array), PUSH_CONST or PUSH_LOCAL, with its operand
+            byte bound_command = 0;
+            u16 bound = 0;
+            // Constant the index is incremented by, unused with array_length
+            u16 step = 0;
+        };
+
+        struct Analysis
+        {
+            std::vector<Loop> loops;
+            // Offsets of the GET_ARRAY and SET_ARRAY instructions a loop keeps in bounds, with its position
+            // in loops. They access array[index] before the loop stores into either variable
+            std::map<std::size_t, std::size_t> accesses;
+        };
+
+        // Analyses length bytes of code from the reader position, leaving the reader at its end
+        Analysis analyze(code::Reader &, std::size_t length);
+    }
+
+    namespace maps
+    {
+        // Runs the map intrinsic with this name on the stack of the environment, false when there is
+        // no such intrinsic
+        bool call(const std::string &name, Environment &);
+    }
+
+    namespace arrays
+    {
+        // Runs the bulk array intrinsic with this name on the stack of the environment, false when
+        // there is no such intrinsic. Typed arrays are processed by SIMD kernels
+        bool call(const std::string &name, Environment &);
+        // Kernels chosen for this CPU: "avx2", "sse2" or "scalar"
+        const char *instruction_set();
+    }
+
+    namespace perf
+    {
+
+        // Describes JIT-compiled code to Linux perf, through /tmp/perf-<pid>.map
+        // and a jitdump file consumed by perf inject --jit
+        void open_map();
+        void open_jitdump();
+        void register_code(const void *, const std::string &);
+        void close();
+
+    }
+
+    namespace workload
+    {
+
+        // Generates the assembly text of a parameterized benchmark program,
+        // unknown parameters are ignored and missing ones take their defaults
+        using Parameters = std::map<std::string, long>;
+
+        std::vector<std::string> names();
+        std::string generate(const std::string &name, const Parameters &);
+
     }
 
     namespace proccess
@@ -333,12 +1015,25 @@ namespace vm
                                   Environment &env,
                                   std::function<void(runtime::Object *)> push,
                                   std::function<void()> pop,
-                                  std::function<void(const char *, std::function<int(int &&, int &&)>, std::function<u32(u32 &&, u32 &&)>, std::function<std::string(std::string &&, std::string &&)>)> arithmetic_operation,
+                                  std::function<void(const char *, std::function<int(int &&, int &&)>, std::function<u32(u32 &&, u32 &&)>)> arithmetic_operation,
                                   std::function<void(const char *, std::function<bool(int &&, int &&)>, std::function<bool(u32 &&, u32 &&)>)> compare_operation,
-                                  std::function<void(const char *, std::function<bool(bool &&, bool &&)>)> logical_operation,
-                                  bool debug_mode);
-
-        void call_intrinsic(u16, Environment &, bool);
+                                  std::function<void(const char *, std::function<bool(bool &&, bool &&)>)> logical_operation);
+
+        template <bool Debug>
+        void call_intrinsic(u16, Environment &);
+
+        // Array instructions on the stack of the environment, shared by the interpreter and compiled code.
+        // Typed arrays box the element GET_ARRAY reads and only take numbers. Checked accesses stop the
+        // program when the operand is not an array or the index is out of bounds, compiled code leaves
+        // the checks out where the range analysis proved them redundant
+        template <bool Checked = true>
+        void get_array(Environment &);
+        template <bool Checked = true>
+        void set_array(Environment &);
+        void init_array(Environment &, u16 size);
+        // The check hoisted out of a counted loop with a constant or local bound, see ranges::Loop.
+        // True when every index the loop reaches with these values is in bounds of the array
+        bool loop_in_bounds(const runtime::Object *array, const runtime::Object *index, const runtime::Object *bound, const runtime::Object *step);
 
         template <typename T>
         inline std::function<T(T &&, T &&)> get_arithmetic_function(byte command)
@@ -2,29 +2,236 @@
 #include <format>
 #include <fstream>
 #include <filesystem>
+#include <csignal>
 #include <cstring>
+#include <sstream>
+#include <string>
 
 #include "vm.hpp"
 
 constexpr static const char *INVALID_ARGUMENTS = "Invalid arguments for ShellVM\n";
 constexpr static const char *USAGE = "\
 shellvm [OPTIONS] file_to_run \n\
+shellvm [OPTIONS] --batch <jobs> [-j <workers>] \n\
+shellvm [OPTIONS] --serve <socket> [preload_jobs] \n\
+shellvm [OPTIONS] --connect <socket> file_to_run \n\
   OPTIONS \n\
-    -d, --debug : Run VM in debug configuration";
+    -d, --debug : Run VM in debug configuration \n\
+    --profile <file> : Sample SnailL call stacks and write them to file in collapsed format \n\
+    --profile-rate <hz> : Sampling frequency of the profiler, 99 by default \n\
+    --perf-map : Describe JIT-compiled functions in /tmp/perf-<pid>.map \n\
+    --jitdump : Write JIT-compiled functions to a jitdump file for perf inject \n\
+    --heap-profile <file> : Count allocations per bytecode site and write them with the live heap as JSON \n\
+    --counters : Report hardware counters and wall time of load, interpret, JIT compile and GC to stderr \n\
+    --stats <file> : Write VM statistics as JSON on exit and on SIGUSR1, - for stderr \n\
+    --bench <runs> : Run the program repeatedly and report timing statistics instead of its output \n\
+    --warmup <runs> : Runs before measuring in --bench mode, 3 by default \n\
+    --reset-jit : Discard JIT state between --bench runs \n\
+    --batch <jobs> : Run every program listed in the jobs file, one per line, in one process \n\
+        and print their outputs in order followed by a throughput summary on stderr \n\
+    -j <workers> : Worker threads of --batch, one per hardware thread by default \n\
+    --serve <socket> : Stay resident and run programs for clients of the Unix socket, keeping their \n\
+        images and JIT output warm, programs listed in preload_jobs are loaded at startup \n\
+    --connect <socket> : Run file_to_run on the server listening on socket and print its output \n\
+    --snapshot <file> : Run the main body up to its snapshot intrinsic and save the globals and heap \n\
+    --from-snapshot <file> : Restore a snapshot of file_to_run and continue after its snapshot point \n\
+    --aot [-o <library>] : Compile every function and the main body of file_to_run into a shared \n\
+        library, next to it with the extension .so unless -o is given \n\
+    --native <library> : Run with the code of a library made by --aot, interpreting when it was built \n\
+        from other bytecode \n\
+    --isolates <count> : Run the program in count isolates on their own threads, sharing code and JIT output \n\
+    --assemble <output> : Assemble the textual program file_to_run into bytecode \n\
+    --disassemble : Print the textual form of the bytecode file_to_run \n\
+    --generate <workload>[:name=value,...] : Write a generated workload to file_to_run, \n\
+        as text when it ends with .sasm, workloads are sum_loop, fibonacci, array_fill, \n\
+        string_concat and call_depth with parameters n, depth and print";
+
+static int invalid_arguments()
+{
+    std::cerr << std::format("{}\n{}\n{}", INVALID_ARGUMENTS, "Usage:", USAGE);
+    return EXIT_FAILURE;
+}
+
+// sum_loop:n=1000,print=1
+static std::string generate(const std::string &spec)
+{
+    std::size_t colon = spec.find(':');
+    vm::workload::Parameters parameters;
+    if (colon != std::string::npos)
+    {
+        std::stringstream list(spec.substr(colon + 1));
+        std::string parameter;
+        while (std::getline(list, parameter, ','))
+        {
+            std::size_t equals = parameter.find('=');
+            if (equals == std::string::npos)
+                throw std::invalid_argument("Workload parameter " + parameter + " has no value");
+            parameters[parameter.substr(0, equals)] = std::stol(parameter.substr(equals + 1));
+        }
+    }
+    return vm::workload::generate(spec.substr(0, colon), parameters);
+}
+
+static void write_file(const fs::path &path, const std::vector<byte> &bytes)
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+static vm::server::Server *running_server = nullptr;
+
+static void stop_server(int)
+{
+    if (running_server != nullptr)
+        running_server->stop();
+}
 
 int main(int argc, char **argv)
 {
     if (argc < 2)
     {
-        std::cerr << std::format("{}\n{}\n{}", INVALID_ARGUMENTS, "Usage:", USAGE);
-        return EXIT_FAILURE;
+        return invalid_arguments();
     }
 
-    bool debug_mode = false;
-    if (argc > 2 && (!std::strcmp("-d", argv[1]) || !strcmp("--debug", argv[1])))
-        debug_mode = true;
+    vm::Options options;
+    fs::path assemble_output;
+    std::string workload;
+    bool disassemble = false;
+    bool aot = false;
+    fs::path output;
+    fs::path target;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!std::strcmp("-d", argv[i]) || !std::strcmp("--debug", argv[i]))
+            options.debug_mode = true;
+        else if (!std::strcmp("--profile", argv[i]) && i + 1 < argc)
+            options.profile_output = argv[++i];
+        else if (!std::strcmp("--profile-rate", argv[i]) && i + 1 < argc)
+            options.profile_frequency = std::stoul(argv[++i]);
+        else if (!std::strcmp("--perf-map", argv[i]))
+            options.perf_map = true;
+        else if (!std::strcmp("--jitdump", argv[i]))
+            options.jitdump = true;
+        else if (!std::strcmp("--heap-profile", argv[i]) && i + 1 < argc)
+            options.heap_profile = argv[++i];
+        else if (!std::strcmp("--counters", argv[i]))
+            options.phase_counters = true;
+        else if (!std::strcmp("--stats", argv[i]) && i + 1 < argc)
+            options.stats_output = argv[++i];
+        else if (!std::strcmp("--bench", argv[i]) && i + 1 < argc)
+            options.bench_runs = std::stoul(argv[++i]);
+        else if (!std::strcmp("--warmup", argv[i]) && i + 1 < argc)
+            options.bench_warmup = std::stoul(argv[++i]);
+        else if (!std::strcmp("--isolates", argv[i]) && i + 1 < argc)
+            options.isolates = std::stoul(argv[++i]);
+        else if (!std::strcmp("--reset-jit", argv[i]))
+            options.bench_reset_jit = true;
+        else if (!std::strcmp("--assemble", argv[i]) && i + 1 < argc)
+            assemble_output = argv[++i];
+        else if (!std::strcmp("--disassemble", argv[i]))
+            disassemble = true;
+        else if (!std::strcmp("--generate", argv[i]) && i + 1 < argc)
+            workload = argv[++i];
+        else if (!std::strcmp("--batch", argv[i]) && i + 1 < argc)
+            options.batch_jobs = argv[++i];
+        else if (!std::strcmp("-j", argv[i]) && i + 1 < argc)
+            options.batch_workers = std::stoul(argv[++i]);
+        else if (!std::strcmp("--snapshot", argv[i]) && i + 1 < argc)
+            options.snapshot_output = argv[++i];
+        else if (!std::strcmp("--from-snapshot", argv[i]) && i + 1 < argc)
+            options.snapshot_input = argv[++i];
+        else if (!std::strcmp("--aot", argv[i]))
+            aot = true;
+        else if (!std::strcmp("-o", argv[i]) && i + 1 < argc)
+            output = argv[++i];
+        else if (!std::strcmp("--native", argv[i]) && i + 1 < argc)
+            options.native_library = argv[++i];
+        else if (!std::strcmp("--serve", argv[i]) && i + 1 < argc)
+            options.serve_socket = argv[++i];
+        else if (!std::strcmp("--connect", argv[i]) && i + 1 < argc)
+            options.connect_socket = argv[++i];
+        else if (argv[i][0] != '-' && target.empty())
+            target = argv[i];
+        else
+            return invalid_arguments();
+    }
 
-    fs::path target(argv[argc - 1]);
+    if (!options.serve_socket.empty())
+    {
+        try
+        {
+            vm::server::Server server(options.serve_socket);
+            if (!target.empty())
+            {
+                for (const fs::path &program : vm::batch::read_jobs(target))
+                    server.preload(program);
+            }
+            running_server = &server;
+            std::signal(SIGINT, stop_server);
+            std::signal(SIGTERM, stop_server);
+            server.run();
+            running_server = nullptr;
+            if (!options.stats_output.empty())
+                vm::stats::write_json(options.stats_output);
+            return EXIT_SUCCESS;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    if (!options.connect_socket.empty())
+    {
+        if (target.empty())
+            return invalid_arguments();
+        try
+        {
+            return vm::server::request(options.connect_socket, target, options.debug_mode, std::cout, std::cerr);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    if (!options.batch_jobs.empty())
+    {
+        try
+        {
+            vm::batch::Summary summary = vm::batch::run(vm::batch::read_jobs(options.batch_jobs), options.batch_workers, options.debug_mode);
+            vm::batch::write_outputs(std::cout, std::cerr, summary);
+            vm::batch::write_summary(std::cerr, summary);
+            if (!options.stats_output.empty())
+                vm::stats::write_json(options.stats_output);
+            return EXIT_SUCCESS;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+    }
+    if (target.empty())
+        return invalid_arguments();
+
+    try
+    {
+        if (!workload.empty())
+        {
+            std::string source = generate(workload);
+            if (target.extension() == ".sasm")
+                std::ofstream(target, std::ios::trunc) << source;
+            else
+                write_file(target, vm::code::assemble(source));
+            return EXIT_SUCCESS;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
 
     if (!fs::exists(target))
     {
@@ -32,5 +239,58 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    vm::process(target, debug_mode);
-}
\ No newline at end of file
+    try
+    {
+        if (!assemble_output.empty())
+        {
+            std::ifstream input(target);
+            std::stringstream source;
+            source << input.rdbuf();
+            write_file(assemble_output, vm::code::assemble(source.str()));
+            return EXIT_SUCCESS;
+        }
+        if (aot)
+        {
+            vm::jit::compile_program(*vm::load_image(target), output.empty() ? fs::path(target).replace_extension(".so") : output);
+            return EXIT_SUCCESS;
+        }
+        if (disassemble)
+        {
+            vm::code::Reader reader(target);
+            vm::code::disassemble(reader, std::cout);
+            return EXIT_SUCCESS;
+        }
+    }
+    catch (const vm::code::InvalidBytecodeException &e)
+    {
+        std::cerr << e.getMessage() << '\n';
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        if (options.bench_runs > 0)
+        {
+            vm::measure::write_report(std::cout, vm::measure::run(target, options));
+            if (!options.stats_output.empty())
+                vm::stats::write_json(options.stats_output);
+            return EXIT_SUCCESS;
+        }
+        vm::process(target, options);
+    }
+    catch (const vm::code::InvalidBytecodeException &e)
+    {
+        std::cerr << e.getMessage() << '\n';
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}
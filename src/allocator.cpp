@@ -1,26 +1,82 @@
 #include "vm.hpp"
+#include <algorithm>
 
 using namespace vm;
 
-runtime::Object *memory::Allocator::create(runtime::Type type, const byte *data, std::size_t data_size)
+runtime::Object *memory::Allocator::create(runtime::Type type, const byte *data, std::size_t data_size, bool growable)
+{
+    return adopt(new runtime::Object(type, data, data_size, growable));
+}
+
+runtime::Object *memory::Allocator::create_array(std::size_t size, runtime::Type element)
+{
+    return adopt(new runtime::Object(size, element));
+}
+
+// The new object is not in the list yet, so collecting first never frees it
+runtime::Object *memory::Allocator::adopt(runtime::Object *obj)
 {
     if (allocated_objects.size() == allocated_objects.capacity())
     {
         collect_garbage();
     }
 
-    runtime::Object *obj = new runtime::Object(type, data, data_size);
+    ++totals.allocations;
+    stats::add(stats::local().allocations);
+    obj->site = site;
+    if (tracking_sites)
+    {
+        SiteCounter &counter = sites[site];
+        ++counter.allocations;
+        counter.bytes += heap::footprint(*obj);
+    }
     allocated_objects.push_back(obj);
     return obj;
 }
 
+void vm::memory::Allocator::reserve(std::size_t count)
+{
+    allocated_objects.reserve(allocated_objects.size() + count);
+}
+
 std::size_t vm::memory::Allocator::size() const
 {
     return allocated_objects.size();
 }
 
+const memory::Allocator::Statistics &vm::memory::Allocator::statistics() const
+{
+    return totals;
+}
+
+void vm::memory::Allocator::track_sites(bool enabled)
+{
+    tracking_sites = enabled;
+}
+
+const std::map<u32, memory::Allocator::SiteCounter> &vm::memory::Allocator::site_counters() const
+{
+    return sites;
+}
+
+const std::vector<runtime::Object *> &vm::memory::Allocator::objects() const
+{
+    return allocated_objects;
+}
+
+void vm::memory::Allocator::reset_statistics()
+{
+    totals = {};
+}
+
 vm::memory::Allocator::~Allocator()
 {
+    // Entries of maps may refer to objects deleted before them
+    for (runtime::Object *obj : allocated_objects)
+    {
+        if (obj->type == runtime::Type::MAP)
+            obj->map().release();
+    }
     for (runtime::Object *obj : allocated_objects)
     {
         delete obj;
@@ -29,6 +85,8 @@ vm::memory::Allocator::~Allocator()
 
 void vm::memory::Allocator::collect_garbage()
 {
+    phases::Scope scope(phases::GC);
+    auto start = std::chrono::steady_clock::now();
     std::size_t current = 0, first_free = 0;
     for (; current < allocated_objects.size(); ++current)
     {
@@ -43,4 +101,14 @@ void vm::memory::Allocator::collect_garbage()
         }
     }
     allocated_objects.resize(first_free);
+
+    auto pause = std::chrono::steady_clock::now() - start;
+    ++totals.collections;
+    totals.collection_time += pause;
+    totals.longest_collection = std::max<std::chrono::nanoseconds>(totals.longest_collection, pause);
+
+    stats::Counters &counters = stats::local();
+    stats::add(counters.collections);
+    stats::add(counters.objects_freed, current - first_free);
+    counters.gc_pause.record(pause);
 }
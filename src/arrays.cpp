@@ -0,0 +1,747 @@
+#include "vm.hpp"
+#include "intrinsics.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace vm;
+using namespace vm::intrinsics;
+
+namespace
+{
+    bool is_number(const runtime::Object *object)
+    {
+        return object->type == runtime::Type::I32 || object->type == runtime::Type::USIZE;
+    }
+
+    bool is_typed(const runtime::Object *array)
+    {
+        return array->element != runtime::Type::VOID;
+    }
+
+    u32 *raw(runtime::Object *array)
+    {
+        return reinterpret_cast<u32 *>(array->data);
+    }
+
+    runtime::Link *links(runtime::Object *array)
+    {
+        return reinterpret_cast<runtime::Link *>(array->data);
+    }
+
+    // Bytecode may store anything in an array whatever its declared element type. A typed array that gets
+    // a value of any other type, a usize in an i32 array too, becomes an array of links with every element
+    // boxed, so each element keeps its type
+    void box_elements(Environment &env, runtime::Object *array)
+    {
+        std::vector<u32> values(raw(array), raw(array) + array->data_size);
+        runtime::Type element = array->element;
+        runtime::free_elements(array->data, array->capacity());
+        array->data = runtime::allocate_elements(values.size() * sizeof(runtime::Link));
+        array->element = runtime::Type::VOID;
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            runtime::Object *boxed = env.allocator.create(element, reinterpret_cast<const byte *>(&values[i]), sizeof(u32));
+            links(array)[i] = boxed;
+        }
+    }
+
+    // The caller keeps array and value linked, boxing elements may collect garbage
+    void store_element(Environment &env, runtime::Object *array, std::size_t position, runtime::Object *value)
+    {
+        if (is_typed(array) && value->type != array->element)
+            box_elements(env, array);
+        if (is_typed(array))
+            raw(array)[position] = static_cast<u32>(*value);
+        else
+            links(array)[position] = value;
+    }
+
+    // Element of the array as an object, typed arrays box it. The result is not linked yet
+    runtime::Object *load_element(Environment &env, runtime::Object *array, std::size_t position)
+    {
+        if (!is_typed(array))
+            return links(array)[position].object;
+        u32 value = raw(array)[position];
+        return env.allocator.create(array->element, reinterpret_cast<const byte *>(&value), sizeof(value));
+    }
+
+    // Kernels work on the raw elements of typed arrays. min and max flip the sign bit of i32 elements
+    // with bias, so one unsigned order serves both element types
+    struct Kernels
+    {
+        const char *name;
+        void (*fill)(u32 *, std::size_t, u32);
+        u32 (*sum)(const u32 *, std::size_t);
+        u32 (*min)(const u32 *, std::size_t, u32 bias);
+        u32 (*max)(const u32 *, std::size_t, u32 bias);
+        // Position of the first element equal to the value, the count when there is none
+        std::size_t (*find)(const u32 *, std::size_t, u32);
+    };
+
+    void fill_scalar(u32 *data, std::size_t count, u32 value)
+    {
+        std::fill(data, data + count, value);
+    }
+
+    u32 sum_scalar(const u32 *data, std::size_t count)
+    {
+        u32 sum = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            sum += data[i];
+        return sum;
+    }
+
+    u32 min_scalar(const u32 *data, std::size_t count, u32 bias)
+    {
+        u32 min = data[0] ^ bias;
+        for (std::size_t i = 1; i < count; ++i)
+            min = std::min(min, data[i] ^ bias);
+        return min ^ bias;
+    }
+
+    u32 max_scalar(const u32 *data, std::size_t count, u32 bias)
+    {
+        u32 max = data[0] ^ bias;
+        for (std::size_t i = 1; i < count; ++i)
+            max = std::max(max, data[i] ^ bias);
+        return max ^ bias;
+    }
+
+    std::size_t find_scalar(const u32 *data, std::size_t count, u32 value)
+    {
+        return static_cast<std::size_t>(std::find(data, data + count, value) - data);
+    }
+
+    constexpr Kernels SCALAR{"scalar", fill_scalar, sum_scalar, min_scalar, max_scalar, find_scalar};
+
+#if defined(__x86_64__)
+    // SSE2 is part of x86-64, it has no unsigned 32 bit comparisons, so min and max compare signed
+    // values with the sign bit flipped once more
+    void fill_sse2(u32 *data, std::size_t count, u32 value)
+    {
+        __m128i values = _mm_set1_epi32(static_cast<int>(value));
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), values);
+        fill_scalar(data + i, count - i, value);
+    }
+
+    u32 sum_sse2(const u32 *data, std::size_t count)
+    {
+        __m128i sums = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            sums = _mm_add_epi32(sums, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        alignas(16) u32 lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sums);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(data + i, count - i);
+    }
+
+    template <bool Min>
+    u32 extreme_sse2(const u32 *data, std::size_t count, u32 bias)
+    {
+        if (count < 4)
+            return Min ? min_scalar(data, count, bias) : max_scalar(data, count, bias);
+        __m128i flip = _mm_set1_epi32(static_cast<int>(bias ^ 0x80000000U));
+        __m128i best = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)), flip);
+        std::size_t i = 4;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), flip);
+            __m128i replace = Min ? _mm_cmpgt_epi32(best, values) : _mm_cmpgt_epi32(values, best);
+            best = _mm_or_si128(_mm_and_si128(replace, values), _mm_andnot_si128(replace, best));
+        }
+        alignas(16) u32 lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), _mm_xor_si128(best, flip));
+        u32 result = Min ? min_scalar(lanes, 4, bias) : max_scalar(lanes, 4, bias);
+        if (i == count)
+            return result;
+        u32 rest = Min ? min_scalar(data + i, count - i, bias) : max_scalar(data + i, count - i, bias);
+        return Min ? std::min(result ^ bias, rest ^ bias) ^ bias : std::max(result ^ bias, rest ^ bias) ^ bias;
+    }
+
+    std::size_t find_sse2(const u32 *data, std::size_t count, u32 value)
+    {
+        __m128i needle = _mm_set1_epi32(static_cast<int>(value));
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), needle));
+            if (mask != 0)
+                return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask))) / 4;
+        }
+        return i + find_scalar(data + i, count - i, value);
+    }
+
+    constexpr Kernels SSE2{"sse2", fill_sse2, sum_sse2, extreme_sse2<true>, extreme_sse2<false>, find_sse2};
+
+    __attribute__((target("avx2"))) void fill_avx2(u32 *data, std::size_t count, u32 value)
+    {
+        __m256i values = _mm256_set1_epi32(static_cast<int>(value));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), values);
+        fill_scalar(data + i, count - i, value);
+    }
+
+    __attribute__((target("avx2"))) u32 sum_avx2(const u32 *data, std::size_t count)
+    {
+        __m256i sums = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+            sums = _mm256_add_epi32(sums, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+        alignas(32) u32 lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sums);
+        return sum_scalar(lanes, 8) + sum_scalar(data + i, count - i);
+    }
+
+    template <bool Min>
+    __attribute__((target("avx2"))) u32 extreme_avx2(const u32 *data, std::size_t count, u32 bias)
+    {
+        if (count < 8)
+            return Min ? min_scalar(data, count, bias) : max_scalar(data, count, bias);
+        __m256i flip = _mm256_set1_epi32(static_cast<int>(bias));
+        __m256i best = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data)), flip);
+        std::size_t i = 8;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), flip);
+            best = Min ? _mm256_min_epu32(best, values) : _mm256_max_epu32(best, values);
+        }
+        alignas(32) u32 lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), best);
+        u32 result = Min ? *std::min_element(lanes, lanes + 8) : *std::max_element(lanes, lanes + 8);
+        for (; i < count; ++i)
+            result = Min ? std::min(result, data[i] ^ bias) : std::max(result, data[i] ^ bias);
+        return result ^ bias;
+    }
+
+    __attribute__((target("avx2"))) std::size_t find_avx2(const u32 *data, std::size_t count, u32 value)
+    {
+        __m256i needle = _mm256_set1_epi32(static_cast<int>(value));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), needle);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+            if (mask != 0)
+                return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+        return i + find_scalar(data + i, count - i, value);
+    }
+
+    constexpr Kernels AVX2{"avx2", fill_avx2, sum_avx2, extreme_avx2<true>, extreme_avx2<false>, find_avx2};
+#endif
+
+    // Chosen once, by what the CPU running the VM supports
+    const Kernels &kernels()
+    {
+        static const Kernels &selected = []() -> const Kernels &
+        {
+#if defined(__x86_64__)
+            if (__builtin_cpu_supports("avx2"))
+                return AVX2;
+            return SSE2;
+#else
+            return SCALAR;
+#endif
+        }();
+        return selected;
+    }
+
+    runtime::Object *element_or_throw(runtime::Object *array, std::size_t position, const char *intrinsic)
+    {
+        runtime::Object *element = links(array)[position].object;
+        if (element == nullptr)
+            throw code::InvalidBytecodeException(std::string(intrinsic) + " found an empty element");
+        return element;
+    }
+
+    void length(Environment &env)
+    {
+        Arguments arguments(env, 1);
+        runtime::Object *array = arguments.array(0, "array_length");
+        push_object(env, number(env, runtime::Type::USIZE, static_cast<u32>(array->data_size)));
+    }
+
+    void fill(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *array = arguments.array(0, "array_fill");
+        runtime::Object *value = arguments[1];
+        if (is_typed(array) && value->type != array->element)
+            box_elements(env, array);
+        if (is_typed(array))
+        {
+            kernels().fill(raw(array), array->data_size, static_cast<u32>(*value));
+            return;
+        }
+        for (std::size_t i = 0; i < array->data_size; ++i)
+            links(array)[i] = value;
+    }
+
+    // array_copy(destination, destination index, source, source index, count), the ranges may overlap
+    void copy(Environment &env)
+    {
+        Arguments arguments(env, 5);
+        runtime::Object *destination = arguments.array(0, "array_copy");
+        std::size_t to = arguments.position(1, "array_copy");
+        runtime::Object *source = arguments.array(2, "array_copy");
+        std::size_t from = arguments.position(3, "array_copy");
+        std::size_t count = arguments.position(4, "array_copy");
+        if (from > source->data_size || count > source->data_size - from || to > destination->data_size || count > destination->data_size - to)
+            throw code::InvalidBytecodeException("array_copy range is out of bounds");
+
+        if (is_typed(destination) && destination->element == source->element)
+        {
+            std::memmove(raw(destination) + to, raw(source) + from, count * sizeof(u32));
+        }
+        else if (!is_typed(destination) && !is_typed(source))
+        {
+            if (destination == source && to > from)
+            {
+                for (std::size_t i = count; i-- > 0;)
+                    links(destination)[to + i] = links(source)[from + i].object;
+            }
+            else
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                    links(destination)[to + i] = links(source)[from + i].object;
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                runtime::Object *value = load_element(env, source, from + i);
+                if (value == nullptr)
+                    throw code::InvalidBytecodeException("array_copy found an empty element");
+                value->links++;
+                store_element(env, destination, to + i, value);
+                value->links--;
+            }
+        }
+    }
+
+    void sum(Environment &env)
+    {
+        Arguments arguments(env, 1);
+        runtime::Object *array = arguments.array(0, "array_sum");
+        if (is_typed(array))
+        {
+            push_object(env, number(env, array->element, kernels().sum(raw(array), array->data_size)));
+            return;
+        }
+        // Like ADD, the sum is usize as soon as one element is
+        runtime::Type type = runtime::Type::I32;
+        u32 sum = 0;
+        for (std::size_t i = 0; i < array->data_size; ++i)
+        {
+            runtime::Object *element = element_or_throw(array, i, "array_sum");
+            if (!is_number(element))
+                throw code::InvalidBytecodeException("array_sum expects numbers");
+            type = std::max(type, element->type);
+            sum += static_cast<u32>(*element);
+        }
+        push_object(env, number(env, type, sum));
+    }
+
+    template <bool Min>
+    void extreme(Environment &env)
+    {
+        const char *name = Min ? "array_min" : "array_max";
+        Arguments arguments(env, 1);
+        runtime::Object *array = arguments.array(0, name);
+        if (array->data_size == 0)
+            throw code::InvalidBytecodeException(std::string(name) + " of an empty array");
+        if (is_typed(array))
+        {
+            u32 bias = array->element == runtime::Type::I32 ? 0x80000000U : 0;
+            u32 value = Min ? kernels().min(raw(array), array->data_size, bias) : kernels().max(raw(array), array->data_size, bias);
+            push_object(env, number(env, array->element, value));
+            return;
+        }
+        runtime::Object *best = element_or_throw(array, 0, name);
+        for (std::size_t i = 1; i < array->data_size; ++i)
+        {
+            runtime::Object *element = element_or_throw(array, i, name);
+            if (Min ? *element < *best : *element > *best)
+                best = element;
+        }
+        push_object(env, best);
+    }
+
+    void index_of(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *array = arguments.array(0, "array_index_of");
+        runtime::Object *value = arguments[1];
+        std::size_t position = array->data_size;
+        if (is_typed(array))
+        {
+            if (value->type == array->element)
+                position = kernels().find(raw(array), array->data_size, static_cast<u32>(*value));
+        }
+        else
+        {
+            for (std::size_t i = 0; i < array->data_size && position == array->data_size; ++i)
+            {
+                runtime::Object *element = links(array)[i].object;
+                if (element != nullptr && *element == *value)
+                    position = i;
+            }
+        }
+        int result = position == array->data_size ? -1 : static_cast<int>(position);
+        push_object(env, number(env, runtime::Type::I32, static_cast<u32>(result)));
+    }
+
+    void equals(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *left = arguments.array(0, "array_equals");
+        runtime::Object *right = arguments.array(1, "array_equals");
+        bool equal = *left == *right;
+        push_object(env, number(env, runtime::Type::I32, equal ? 1 : 0));
+    }
+
+    // Below this many elements the passes over the histograms cost more than comparing
+    constexpr std::size_t RADIX_THRESHOLD = 256;
+
+    // LSD radix sort over the bytes of the elements, with bias flipping the sign bit of i32 elements.
+    // Passes over a byte that every element shares are skipped
+    void radix_sort(u32 *data, std::size_t count, u32 bias)
+    {
+        std::vector<u32> buffer(count);
+        u32 *from = data, *to = buffer.data();
+        for (unsigned shift = 0; shift < 32; shift += 8)
+        {
+            std::size_t offsets[256] = {};
+            for (std::size_t i = 0; i < count; ++i)
+                ++offsets[((from[i] ^ bias) >> shift) & 0xFF];
+            if (offsets[((from[0] ^ bias) >> shift) & 0xFF] == count)
+                continue;
+            std::size_t position = 0;
+            for (std::size_t &offset : offsets)
+                position += std::exchange(offset, position);
+            for (std::size_t i = 0; i < count; ++i)
+                to[offsets[((from[i] ^ bias) >> shift) & 0xFF]++] = from[i];
+            std::swap(from, to);
+        }
+        if (from != data)
+            std::copy(from, from + count, data);
+    }
+
+    // Element as the order of elements sees it: the object, or the type and value of a raw element
+    struct Item
+    {
+        const runtime::Object *object = nullptr;
+        runtime::Type type = runtime::Type::VOID;
+        u32 value = 0;
+
+        bool empty() const
+        {
+            return object == nullptr && type == runtime::Type::VOID;
+        }
+
+        u32 number() const
+        {
+            return object != nullptr ? static_cast<u32>(*object) : value;
+        }
+    };
+
+    Item item(const runtime::Object *object)
+    {
+        return {object, object != nullptr ? object->type : runtime::Type::VOID};
+    }
+
+    Item item_at(const runtime::Object *array, std::size_t position)
+    {
+        if (is_typed(array))
+            return {nullptr, array->element, reinterpret_cast<const u32 *>(array->data)[position]};
+        return item(reinterpret_cast<const runtime::Link *>(array->data)[position].object);
+    }
+
+    // Deeper arrays are taken for arrays that contain themselves
+    constexpr std::size_t ORDER_DEPTH = 1000;
+
+    // Order of the elements of arrays of links: empty elements last, then by type. Numbers and strings
+    // are ordered by value and arrays element by element, a prefix first. Maps have no order
+    int order(const Item &left, const Item &right, std::size_t depth)
+    {
+        if (left.empty() || right.empty())
+            return static_cast<int>(left.empty()) - static_cast<int>(right.empty());
+        if (left.type != right.type)
+            return left.type < right.type ? -1 : 1;
+        switch (left.type)
+        {
+        case runtime::Type::I32:
+        {
+            int first = static_cast<int>(left.number()), second = static_cast<int>(right.number());
+            return first < second ? -1 : first > second;
+        }
+        case runtime::Type::USIZE:
+            return left.number() < right.number() ? -1 : left.number() > right.number();
+        case runtime::Type::STRING:
+            return left.object->compare(*right.object);
+        case runtime::Type::ARRAY:
+        {
+            if (left.object == right.object)
+                return 0;
+            if (depth == ORDER_DEPTH)
+                throw code::InvalidBytecodeException("Arrays are nested too deeply to be ordered");
+            std::size_t common = std::min(left.object->data_size, right.object->data_size);
+            for (std::size_t i = 0; i < common; ++i)
+            {
+                int result = order(item_at(left.object, i), item_at(right.object, i), depth + 1);
+                if (result != 0)
+                    return result;
+            }
+            return left.object->data_size < right.object->data_size ? -1 : left.object->data_size > right.object->data_size;
+        }
+        default:
+            throw code::InvalidBytecodeException("Maps cannot be ordered");
+        }
+    }
+
+    bool element_less(const runtime::Object *left, const runtime::Object *right)
+    {
+        return order(item(left), item(right), 0) < 0;
+    }
+
+    bool same_type(runtime::Object *array, runtime::Type type)
+    {
+        for (std::size_t i = 0; i < array->data_size; ++i)
+        {
+            const runtime::Object *element = links(array)[i].object;
+            if (element == nullptr || element->type != type)
+                return false;
+        }
+        return true;
+    }
+
+    // The sorted array holds the same objects, so their link counts stay as they are
+    void sort_links(runtime::Object *array)
+    {
+        std::vector<runtime::Object *> elements(array->data_size);
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            elements[i] = links(array)[i].object;
+
+        if (same_type(array, runtime::Type::I32) || same_type(array, runtime::Type::USIZE))
+        {
+            // Sorting the values next to their objects keeps the comparisons out of the objects' data
+            u32 bias = !elements.empty() && elements[0]->type == runtime::Type::I32 ? 0x80000000U : 0;
+            std::vector<std::pair<u32, runtime::Object *>> keyed(elements.size());
+            for (std::size_t i = 0; i < elements.size(); ++i)
+                keyed[i] = {static_cast<u32>(*elements[i]) ^ bias, elements[i]};
+            std::stable_sort(keyed.begin(), keyed.end(), [](const auto &left, const auto &right)
+                             { return left.first < right.first; });
+            for (std::size_t i = 0; i < elements.size(); ++i)
+                elements[i] = keyed[i].second;
+        }
+        else if (same_type(array, runtime::Type::STRING))
+        {
+            std::stable_sort(elements.begin(), elements.end(), [](const runtime::Object *left, const runtime::Object *right)
+                             { return left->compare(*right) < 0; });
+        }
+        else
+        {
+            std::stable_sort(elements.begin(), elements.end(), element_less);
+        }
+
+        for (std::size_t i = 0; i < elements.size(); ++i)
+            links(array)[i].object = elements[i];
+    }
+
+    void sort(Environment &env)
+    {
+        Arguments arguments(env, 1);
+        runtime::Object *array = arguments.array(0, "array_sort");
+        if (!is_typed(array))
+        {
+            sort_links(array);
+            return;
+        }
+        u32 bias = array->element == runtime::Type::I32 ? 0x80000000U : 0;
+        if (array->data_size >= RADIX_THRESHOLD)
+        {
+            radix_sort(raw(array), array->data_size, bias);
+            return;
+        }
+        std::sort(raw(array), raw(array) + array->data_size, [bias](u32 left, u32 right)
+                  { return (left ^ bias) < (right ^ bias); });
+    }
+
+    // Position of an element equal to the value in a sorted array, -(insertion point) - 1 when there is
+    // none, so a missing value can still be inserted in order
+    void binary_search(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *array = arguments.array(0, "array_binary_search");
+        runtime::Object *value = arguments[1];
+        std::size_t position;
+        bool found;
+        if (is_typed(array))
+        {
+            if (!is_number(value))
+                throw code::InvalidBytecodeException("array_binary_search expects a number");
+            u32 bias = array->element == runtime::Type::I32 ? 0x80000000U : 0;
+            u32 key = static_cast<u32>(*value) ^ bias;
+            const u32 *begin = raw(array), *end = begin + array->data_size;
+            const u32 *lower = std::lower_bound(begin, end, key, [bias](u32 element, u32 key)
+                                                { return (element ^ bias) < key; });
+            position = static_cast<std::size_t>(lower - begin);
+            found = lower != end && (*lower ^ bias) == key;
+        }
+        else
+        {
+            runtime::Link *begin = links(array), *end = begin + array->data_size;
+            runtime::Link *lower = std::lower_bound(begin, end, value, [](const runtime::Link &element, const runtime::Object *value)
+                                                    { return element_less(element.object, value); });
+            position = static_cast<std::size_t>(lower - begin);
+            found = lower != end && lower->object != nullptr && !element_less(value, lower->object);
+        }
+        int result = found ? static_cast<int>(position) : -static_cast<int>(position) - 1;
+        push_object(env, number(env, runtime::Type::I32, static_cast<u32>(result)));
+    }
+
+    // Position an instruction indexes the array at, after checking that it is one
+    u32 checked_position(const runtime::Object *array, const runtime::Object *index, const char *instruction)
+    {
+        if (array == nullptr || array->type != runtime::Type::ARRAY)
+            throw code::InvalidBytecodeException(std::string(instruction) + " of something that is not an array");
+        if (index == nullptr || !is_number(index))
+            throw code::InvalidBytecodeException(std::string(instruction) + " with an index that is not a number");
+        u32 position = static_cast<u32>(*index);
+        if (position >= array->data_size)
+        {
+            std::string shown = index->type == runtime::Type::I32 ? std::to_string(static_cast<int>(*index)) : std::to_string(position);
+            throw code::InvalidBytecodeException(std::string(instruction) + " index " + shown + " is out of bounds for length " + std::to_string(array->data_size));
+        }
+        return position;
+    }
+}
+
+template <bool Checked>
+void proccess::get_array(Environment &env)
+{
+    runtime::Object *index = env.stack.top();
+    pop_object(env);
+    runtime::Object *array = env.stack.top();
+    pop_object(env);
+    u32 position = Checked ? checked_position(array, index, "GET_ARRAY") : static_cast<u32>(*index);
+    if (!is_typed(array))
+    {
+        // No analysis proves which elements were stored, so this check stays in unchecked accesses too
+        runtime::Object *element = links(array)[position].object;
+        if (element == nullptr)
+            throw code::InvalidBytecodeException("GET_ARRAY of an empty element");
+        push_object(env, element);
+        return;
+    }
+    // Read before allocating, the collection it may run can free the array
+    u32 value = raw(array)[position];
+    push_object(env, number(env, array->element, value));
+}
+
+template void proccess::get_array<true>(Environment &);
+template void proccess::get_array<false>(Environment &);
+
+template <bool Checked>
+void proccess::set_array(Environment &env)
+{
+    runtime::Object *index = env.stack.top();
+    pop_object(env);
+    // The value keeps the link of its stack slot and the array stays on the stack until it is stored
+    runtime::Object *value = env.stack.top();
+    env.stack.pop();
+    runtime::Object *array = env.stack.top();
+    u32 position;
+    try
+    {
+        position = Checked ? checked_position(array, index, "SET_ARRAY") : static_cast<u32>(*index);
+    }
+    catch (...)
+    {
+        value->links--;
+        throw;
+    }
+    store_element(env, array, position, value);
+    value->links--;
+    pop_object(env);
+}
+
+template void proccess::set_array<true>(Environment &);
+template void proccess::set_array<false>(Environment &);
+
+// The value on top of the stack becomes element 0
+void proccess::init_array(Environment &env, u16 size)
+{
+    std::vector<runtime::Object *> values(size);
+    for (u16 i = 0; i < size; ++i)
+    {
+        values[i] = env.stack.top();
+        env.stack.pop();
+    }
+    runtime::Object *array = env.stack.top();
+    if (array == nullptr || array->type != runtime::Type::ARRAY || size > array->data_size)
+    {
+        for (runtime::Object *value : values)
+            value->links--;
+        throw code::InvalidBytecodeException("INIT_ARRAY of " + std::to_string(size) + " elements does not fit the array");
+    }
+    for (u16 i = 0; i < size; ++i)
+        store_element(env, array, i, values[i]);
+    for (runtime::Object *value : values)
+        value->links--;
+}
+
+bool proccess::loop_in_bounds(const runtime::Object *array, const runtime::Object *index, const runtime::Object *bound, const runtime::Object *step)
+{
+    if (array == nullptr || index == nullptr || bound == nullptr || array->type != runtime::Type::ARRAY)
+        return false;
+    // Adding a step of the index's own type keeps that type, so the header compares in it every time
+    if (index->type != step->type || bound->type != step->type)
+        return false;
+    if (step->type == runtime::Type::USIZE)
+        return static_cast<u32>(*bound) <= array->data_size;
+    if (step->type != runtime::Type::I32)
+        return false;
+    // A positive step that cannot overflow below the bound keeps a non-negative index non-negative
+    int increment = static_cast<int>(*step), limit = static_cast<int>(*bound);
+    return increment > 0 && static_cast<int>(*index) >= 0 && limit <= std::numeric_limits<int>::max() - increment &&
+           (limit < 0 || static_cast<std::size_t>(limit) <= array->data_size);
+}
+
+bool arrays::call(const std::string &name, Environment &env)
+{
+    static const std::unordered_map<std::string, void (*)(Environment &)> intrinsics{
+        {"array_length", length},
+        {"array_fill", fill},
+        {"array_copy", copy},
+        {"array_sum", sum},
+        {"array_min", extreme<true>},
+        {"array_max", extreme<false>},
+        {"array_index_of", index_of},
+        {"array_equals", equals},
+        {"array_sort", sort},
+        {"array_binary_search", binary_search},
+    };
+    auto intrinsic = intrinsics.find(name);
+    if (intrinsic == intrinsics.end())
+        return false;
+    intrinsic->second(env);
+    return true;
+}
+
+const char *arrays::instruction_set()
+{
+    return kernels().name;
+}
@@ -0,0 +1,636 @@
+#include "vm.hpp"
+#include <cctype>
+#include <charconv>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace vm::code;
+using vm::runtime::Type;
+
+namespace
+{
+    enum class Operand
+    {
+        NONE,
+        INDEX,
+        JUMP,
+        ARRAY
+    };
+
+    Operand operand_of(byte command)
+    {
+        switch (command)
+        {
+        case Command::PUSH_CONST:
+        case Command::PUSH_LOCAL:
+        case Command::PUSH_GLOBAL:
+        case Command::STORE_LOCAL:
+        case Command::STORE_GLOBAL:
+        case Command::CALL:
+        case Command::INIT_ARRAY:
+        case Command::INTRINSIC_CALL:
+            return Operand::INDEX;
+        case Command::JMP:
+        case Command::JMP_IF_FALSE:
+        case Command::JMP_IF_TRUE:
+            return Operand::JUMP;
+        case Command::NEW_ARRAY:
+            return Operand::ARRAY;
+        default:
+            return Operand::NONE;
+        }
+    }
+
+    const char *type_name(byte type)
+    {
+        switch (type)
+        {
+        case Type::VOID:
+            return "void";
+        case Type::I32:
+            return "i32";
+        case Type::USIZE:
+            return "usize";
+        case Type::STRING:
+            return "string";
+        case Type::ARRAY:
+            return "array";
+        case Type::MAP:
+            return "map";
+        default:
+            throw InvalidBytecodeException("Unknown type byte " + std::to_string(type));
+        }
+    }
+
+    const std::map<std::string, byte> &commands()
+    {
+        static const std::map<std::string, byte> table = []
+        {
+            std::map<std::string, byte> names;
+            for (unsigned command = 0; command <= 0xFF; ++command)
+            {
+                try
+                {
+                    names.emplace(command_name(static_cast<byte>(command)), static_cast<byte>(command));
+                }
+                catch (const InvalidBytecodeException &)
+                {
+                }
+            }
+            return names;
+        }();
+        return table;
+    }
+
+    void put_16(std::vector<byte> &out, u16 value)
+    {
+        out.push_back(value >> 8);
+        out.push_back(value & 0xFF);
+    }
+
+    void put_32(std::vector<byte> &out, u32 value)
+    {
+        put_16(out, value >> 16);
+        put_16(out, value & 0xFFFF);
+    }
+
+    struct Fixup
+    {
+        std::size_t position;
+        std::string label;
+        std::size_t line;
+    };
+
+    struct Section
+    {
+        std::string name;
+        byte arg_count = 0;
+        Type return_type = Type::VOID;
+        u16 local_count = 0;
+        std::vector<byte> code;
+        std::map<std::string, std::size_t> labels;
+        std::vector<Fixup> fixups;
+    };
+
+    class Assembler
+    {
+    public:
+        std::vector<byte> assemble(std::string_view source)
+        {
+            std::size_t begin = 0;
+            while (begin <= source.size())
+            {
+                std::size_t end = source.find('\n', begin);
+                if (end == std::string_view::npos)
+                    end = source.size();
+                ++line;
+                parse_line(source.substr(begin, end - begin));
+                begin = end + 1;
+            }
+            if (current != nullptr)
+                error("Missing .end");
+            if (!has_body)
+                error("Missing .body section");
+            return write();
+        }
+
+    private:
+        std::size_t line = 0;
+        u16 version = 1;
+        u16 main_index = 0;
+        std::vector<byte> constants;
+        u16 constant_count = 0;
+        std::vector<byte> globals;
+        u16 global_count = 0;
+        std::vector<Section> functions;
+        std::vector<byte> intrinsics;
+        u16 intrinsic_count = 0;
+        Section body;
+        bool has_body = false;
+        Section *current = nullptr;
+
+        [[noreturn]] void error(const std::string &message) const
+        {
+            throw InvalidBytecodeException("line " + std::to_string(line) + ": " + message);
+        }
+
+        std::vector<std::string> tokenize(std::string_view text) const
+        {
+            std::vector<std::string> tokens;
+            std::size_t i = 0;
+            while (i < text.size())
+            {
+                char c = text[i];
+                if (c == ';' || c == '#')
+                    break;
+                if (std::isspace(static_cast<unsigned char>(c)) || c == ',')
+                {
+                    ++i;
+                    continue;
+                }
+                if (c == '"')
+                {
+                    std::string token = "\"";
+                    for (++i; i < text.size() && text[i] != '"'; ++i)
+                    {
+                        if (text[i] != '\\')
+                        {
+                            token.push_back(text[i]);
+                            continue;
+                        }
+                        if (++i == text.size())
+                            error("Unterminated escape sequence");
+                        switch (text[i])
+                        {
+                        case 'n':
+                            token.push_back('\n');
+                            break;
+                        case 't':
+                            token.push_back('\t');
+                            break;
+                        case 'x':
+                        {
+                            if (i + 2 >= text.size())
+                                error("Incomplete \\x escape");
+                            int value = 0;
+                            std::from_chars(text.data() + i + 1, text.data() + i + 3, value, 16);
+                            token.push_back(static_cast<char>(value));
+                            i += 2;
+                            break;
+                        }
+                        default:
+                            token.push_back(text[i]);
+                        }
+                    }
+                    if (i == text.size())
+                        error("Unterminated string");
+                    ++i;
+                    tokens.push_back(token);
+                    continue;
+                }
+                std::size_t start = i;
+                while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])) && text[i] != ',' && text[i] != ';')
+                    ++i;
+                tokens.emplace_back(text.substr(start, i - start));
+            }
+            return tokens;
+        }
+
+        long number(const std::string &token) const
+        {
+            long value = 0;
+            const char *begin = token.data(), *end = token.data() + token.size();
+            int base = 10;
+            bool negative = !token.empty() && token[0] == '-';
+            if (negative)
+                ++begin;
+            if (end - begin > 2 && begin[0] == '0' && (begin[1] == 'x' || begin[1] == 'X'))
+            {
+                begin += 2;
+                base = 16;
+            }
+            auto [ptr, ec] = std::from_chars(begin, end, value, base);
+            if (ec != std::errc() || ptr != end || begin == end)
+                error("Expected a number, found '" + token + "'");
+            return negative ? -value : value;
+        }
+
+        Type type(const std::string &token) const
+        {
+            for (byte id = Type::VOID; id <= Type::MAP; ++id)
+            {
+                if (token == type_name(id))
+                    return static_cast<Type>(id);
+            }
+            error("Unknown type '" + token + "'");
+        }
+
+        void expect(const std::vector<std::string> &tokens, std::size_t count) const
+        {
+            if (tokens.size() != count)
+                error("'" + tokens[0] + "' expects " + std::to_string(count - 1) + " arguments");
+        }
+
+        void parse_line(std::string_view text)
+        {
+            std::vector<std::string> tokens = tokenize(text);
+            while (!tokens.empty() && tokens[0].size() > 1 && tokens[0].back() == ':' && tokens[0][0] != '"')
+            {
+                if (current == nullptr)
+                    error("Label outside of a function or body");
+                std::string label = tokens[0].substr(0, tokens[0].size() - 1);
+                if (!current->labels.emplace(label, current->code.size()).second)
+                    error("Duplicate label '" + label + "'");
+                tokens.erase(tokens.begin());
+            }
+            if (tokens.empty())
+                return;
+
+            if (tokens[0][0] == '.')
+                directive(tokens);
+            else if (current == nullptr)
+                error("Instruction outside of a function or body");
+            else
+                instruction(tokens);
+        }
+
+        void directive(const std::vector<std::string> &tokens)
+        {
+            const std::string &name = tokens[0];
+            if (name == ".end")
+            {
+                if (current == nullptr)
+                    error(".end without .function or .body");
+                resolve(*current);
+                current = nullptr;
+                return;
+            }
+            if (current != nullptr)
+                error("Directive " + name + " inside of a function or body");
+
+            if (name == ".version")
+            {
+                expect(tokens, 2);
+                version = static_cast<u16>(number(tokens[1]));
+            }
+            else if (name == ".main")
+            {
+                expect(tokens, 2);
+                main_index = static_cast<u16>(number(tokens[1]));
+            }
+            else if (name == ".const")
+            {
+                expect(tokens, 3);
+                Type constant_type = type(tokens[1]);
+                constants.push_back(constant_type);
+                if (constant_type == Type::I32 || constant_type == Type::USIZE)
+                {
+                    put_32(constants, static_cast<u32>(number(tokens[2])));
+                }
+                else if (constant_type == Type::STRING && tokens[2][0] == '"')
+                {
+                    put_16(constants, static_cast<u16>(tokens[2].size() - 1));
+                    constants.insert(constants.end(), tokens[2].begin() + 1, tokens[2].end());
+                }
+                else
+                {
+                    error("Unsupported constant");
+                }
+                ++constant_count;
+            }
+            else if (name == ".global")
+            {
+                if (tokens.size() < 3)
+                    error(".global expects a name and a type");
+                globals.push_back(static_cast<byte>(tokens[1].size()));
+                globals.insert(globals.end(), tokens[1].begin(), tokens[1].end());
+                Type global_type = type(tokens[2]);
+                globals.push_back(global_type);
+                if (global_type == Type::ARRAY)
+                {
+                    expect(tokens, 5);
+                    globals.push_back(type(tokens[3]));
+                    put_32(globals, static_cast<u32>(number(tokens[4])));
+                }
+                else
+                {
+                    expect(tokens, 3);
+                }
+                ++global_count;
+            }
+            else if (name == ".intrinsic")
+            {
+                expect(tokens, 4);
+                intrinsics.push_back(static_cast<byte>(tokens[1].size()));
+                intrinsics.insert(intrinsics.end(), tokens[1].begin(), tokens[1].end());
+                intrinsics.push_back(static_cast<byte>(number(tokens[2])));
+                intrinsics.push_back(type(tokens[3]));
+                ++intrinsic_count;
+            }
+            else if (name == ".function")
+            {
+                expect(tokens, 5);
+                Section &function = functions.emplace_back();
+                function.name = tokens[1];
+                function.arg_count = static_cast<byte>(number(tokens[2]));
+                function.return_type = type(tokens[3]);
+                function.local_count = static_cast<u16>(number(tokens[4]));
+                current = &function;
+            }
+            else if (name == ".body")
+            {
+                expect(tokens, 1);
+                if (has_body)
+                    error("Duplicate .body section");
+                has_body = true;
+                current = &body;
+            }
+            else
+            {
+                error("Unknown directive " + name);
+            }
+        }
+
+        void instruction(const std::vector<std::string> &tokens)
+        {
+            auto found = commands().find(tokens[0]);
+            if (found == commands().end())
+                error("Unknown instruction '" + tokens[0] + "'");
+            byte command = found->second;
+
+            std::vector<byte> &code = current->code;
+            code.push_back(command);
+            switch (operand_of(command))
+            {
+            case Operand::NONE:
+                expect(tokens, 1);
+                break;
+            case Operand::INDEX:
+                expect(tokens, 2);
+                put_16(code, static_cast<u16>(number(tokens[1])));
+                break;
+            case Operand::JUMP:
+                expect(tokens, 2);
+                if (std::isdigit(static_cast<unsigned char>(tokens[1][0])) || tokens[1][0] == '-')
+                {
+                    put_16(code, static_cast<u16>(static_cast<std::int16_t>(number(tokens[1]))));
+                }
+                else
+                {
+                    current->fixups.push_back({code.size(), tokens[1], line});
+                    put_16(code, 0);
+                }
+                break;
+            case Operand::ARRAY:
+                expect(tokens, 3);
+                put_32(code, static_cast<u32>(number(tokens[1])));
+                code.push_back(type(tokens[2]));
+                break;
+            }
+        }
+
+        // Jump operands are relative to the end of the jump instruction
+        void resolve(Section &section)
+        {
+            for (const Fixup &fixup : section.fixups)
+            {
+                auto label = section.labels.find(fixup.label);
+                if (label == section.labels.end())
+                {
+                    line = fixup.line;
+                    error("Unknown label '" + fixup.label + "'");
+                }
+                long delta = static_cast<long>(label->second) - static_cast<long>(fixup.position + 2);
+                if (delta < INT16_MIN || delta > INT16_MAX)
+                {
+                    line = fixup.line;
+                    error("Jump to '" + fixup.label + "' is too far");
+                }
+                section.code[fixup.position] = static_cast<u16>(delta) >> 8;
+                section.code[fixup.position + 1] = static_cast<u16>(delta) & 0xFF;
+            }
+        }
+
+        std::vector<byte> write() const
+        {
+            std::vector<byte> out;
+            put_32(out, 0x534E4131U);
+            put_16(out, version);
+            put_16(out, main_index);
+            put_16(out, constant_count);
+            out.insert(out.end(), constants.begin(), constants.end());
+            put_16(out, global_count);
+            out.insert(out.end(), globals.begin(), globals.end());
+            put_16(out, static_cast<u16>(functions.size()));
+            for (const Section &function : functions)
+            {
+                out.push_back(static_cast<byte>(function.name.size()));
+                out.insert(out.end(), function.name.begin(), function.name.end());
+                out.push_back(function.arg_count);
+                out.push_back(function.return_type);
+                put_16(out, function.local_count);
+                put_32(out, static_cast<u32>(function.code.size()));
+                out.insert(out.end(), function.code.begin(), function.code.end());
+            }
+            put_16(out, intrinsic_count);
+            out.insert(out.end(), intrinsics.begin(), intrinsics.end());
+            put_32(out, static_cast<u32>(body.code.size()));
+            out.insert(out.end(), body.code.begin(), body.code.end());
+            return out;
+        }
+    };
+
+    std::string read_name(Reader &reader)
+    {
+        byte length = reader.read_byte();
+        std::string name(length, '\0');
+        for (byte i = 0; i < length; ++i)
+            name[i] = static_cast<char>(reader.read_byte());
+        return name;
+    }
+
+    void write_string(std::ostream &output, const std::string &value)
+    {
+        output << '"';
+        for (char c : value)
+        {
+            unsigned char code = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+                output << '\\' << c;
+            else if (c == '\n')
+                output << "\\n";
+            else if (c == '\t')
+                output << "\\t";
+            else if (code < 0x20 || code >= 0x7F)
+                output << "\\x" << "0123456789abcdef"[code >> 4] << "0123456789abcdef"[code & 0xF];
+            else
+                output << c;
+        }
+        output << '"';
+    }
+
+    void disassemble_code(Reader &reader, u32 length, std::ostream &output)
+    {
+        std::vector<byte> code(length);
+        for (u32 i = 0; i < length; ++i)
+            code[i] = reader.read_byte();
+
+        auto read_16 = [&code](std::size_t position)
+        { return static_cast<u16>(code[position] << 8 | code[position + 1]); };
+
+        std::map<std::size_t, std::string> labels;
+        for (std::size_t position = 0; position < code.size();)
+        {
+            byte command = code[position++];
+            switch (operand_of(command))
+            {
+            case Operand::INDEX:
+                position += 2;
+                break;
+            case Operand::JUMP:
+            {
+                std::size_t target = position + 2 + static_cast<std::int16_t>(read_16(position));
+                labels.emplace(target, "L" + std::to_string(target));
+                position += 2;
+                break;
+            }
+            case Operand::ARRAY:
+                position += 5;
+                break;
+            case Operand::NONE:
+                break;
+            }
+        }
+
+        for (std::size_t position = 0; position < code.size();)
+        {
+            auto label = labels.find(position);
+            if (label != labels.end())
+                output << label->second << ":\n";
+            byte command = code[position++];
+            output << "    " << command_name(command);
+            switch (operand_of(command))
+            {
+            case Operand::INDEX:
+                output << ' ' << read_16(position);
+                position += 2;
+                break;
+            case Operand::JUMP:
+                output << " L" << position + 2 + static_cast<std::int16_t>(read_16(position));
+                position += 2;
+                break;
+            case Operand::ARRAY:
+                output << ' ' << (static_cast<u32>(read_16(position)) << 16 | read_16(position + 2)) << ' ' << type_name(code[position + 4]);
+                position += 5;
+                break;
+            case Operand::NONE:
+                break;
+            }
+            output << '\n';
+        }
+        auto label = labels.find(code.size());
+        if (label != labels.end())
+            output << label->second << ":\n";
+    }
+}
+
+std::vector<byte> vm::code::assemble(std::string_view source)
+{
+    return Assembler().assemble(source);
+}
+
+void vm::code::disassemble(Reader &reader, std::ostream &output)
+{
+    Header header = reader.read_header();
+    if (header.magic != 0x534E4131U)
+        throw InvalidBytecodeException("Magic constant is invalid!");
+    output << ".version " << header.version << '\n'
+           << ".main " << header.main_function_index << "\n\n";
+
+    u16 constants = reader.read_16();
+    for (u16 i = 0; i < constants; ++i)
+    {
+        byte type = reader.read_byte();
+        output << ".const " << type_name(type) << ' ';
+        if (type == Type::I32)
+            output << static_cast<std::int32_t>(reader.read_32());
+        else if (type == Type::USIZE)
+            output << reader.read_32();
+        else if (type == Type::STRING)
+        {
+            std::string value(reader.read_16(), '\0');
+            for (char &c : value)
+                c = static_cast<char>(reader.read_byte());
+            write_string(output, value);
+        }
+        else
+            throw InvalidBytecodeException("Unexpected type in constant pool");
+        output << "    ; " << i << '\n';
+    }
+
+    u16 globals = reader.read_16();
+    if (globals > 0)
+        output << '\n';
+    for (u16 i = 0; i < globals; ++i)
+    {
+        std::string name = read_name(reader);
+        byte type = reader.read_byte();
+        output << ".global " << name << ' ' << type_name(type);
+        if (type == Type::ARRAY)
+        {
+            byte element = reader.read_byte();
+            output << ' ' << type_name(element) << ' ' << reader.read_32();
+        }
+        output << "    ; " << i << '\n';
+    }
+
+    u16 functions = reader.read_16();
+    for (u16 i = 0; i < functions; ++i)
+    {
+        std::string name = read_name(reader);
+        int arg_count = reader.read_byte();
+        const char *return_type = type_name(reader.read_byte());
+        u16 local_count = reader.read_16();
+        u32 length = reader.read_32();
+        output << "\n.function " << name << ' ' << arg_count << ' ' << return_type << ' ' << local_count << "    ; " << i << '\n';
+        disassemble_code(reader, length, output);
+        output << ".end\n";
+    }
+
+    u16 intrinsics = reader.read_16();
+    if (intrinsics > 0)
+        output << '\n';
+    for (u16 i = 0; i < intrinsics; ++i)
+    {
+        std::string name = read_name(reader);
+        int arg_count = reader.read_byte();
+        output << ".intrinsic " << name << ' ' << arg_count << ' ' << type_name(reader.read_byte()) << "    ; " << i << '\n';
+    }
+
+    u32 length = reader.read_32();
+    output << "\n.body\n";
+    disassemble_code(reader, length, output);
+    output << ".end\n";
+}
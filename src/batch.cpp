@@ -0,0 +1,230 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+using namespace vm;
+
+namespace
+{
+    std::vector<byte> read_file(const fs::path &file)
+    {
+        std::ifstream input(file, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("File opening failed");
+        return std::vector<byte>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    // Every worker starts with a contiguous range of jobs, takes work from the front
+    // of its own queue and steals from the back of the others once it runs dry
+    class Pool
+    {
+    public:
+        Pool(std::size_t jobs, unsigned workers) : queues(workers)
+        {
+            for (unsigned worker = 0; worker < workers; ++worker)
+            {
+                for (std::size_t job = jobs * worker / workers; job < jobs * (worker + 1) / workers; ++job)
+                    queues[worker].jobs.push_back(job);
+            }
+        }
+
+        template <typename Work>
+        void run(Work work)
+        {
+            std::vector<std::thread> threads;
+            for (unsigned worker = 0; worker < queues.size(); ++worker)
+            {
+                threads.emplace_back([this, &work, worker]
+                                     {
+                                         std::size_t job;
+                                         while (take(worker, job))
+                                             work(job); });
+            }
+            for (std::thread &thread : threads)
+                thread.join();
+        }
+
+        std::size_t steals() const
+        {
+            return stolen.load();
+        }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::size_t> jobs;
+        };
+
+        // No job is added while the pool runs, so empty queues everywhere mean the work is done
+        bool take(unsigned worker, std::size_t &job)
+        {
+            {
+                Queue &own = queues[worker];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.jobs.empty())
+                {
+                    job = own.jobs.front();
+                    own.jobs.pop_front();
+                    return true;
+                }
+            }
+            for (std::size_t i = 1; i < queues.size(); ++i)
+            {
+                Queue &victim = queues[(worker + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.jobs.empty())
+                {
+                    job = victim.jobs.back();
+                    victim.jobs.pop_back();
+                    ++stolen;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::vector<Queue> queues;
+        std::atomic<std::size_t> stolen{0};
+    };
+
+    void run_job(batch::ImageCache &cache, batch::Job &job, bool debug_mode)
+    {
+        std::ostringstream output;
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            Environment env(cache.get(job.file));
+            env.output = &output;
+            vm::run(env, debug_mode);
+        }
+        catch (const runtime::HaltException &e)
+        {
+            job.error = e.getMessage();
+        }
+        catch (const code::InvalidBytecodeException &e)
+        {
+            job.error = e.getMessage();
+        }
+        catch (const std::exception &e)
+        {
+            job.error = e.what();
+        }
+        job.wall_time = std::chrono::steady_clock::now() - start;
+        job.output = output.str();
+    }
+
+    double seconds(std::chrono::nanoseconds duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+}
+
+std::shared_ptr<Image> batch::ImageCache::get(const fs::path &file)
+{
+    std::vector<byte> bytes = read_file(file);
+    std::pair<std::string, std::uint64_t> key{fs::absolute(file).lexically_normal().string(), content_hash(bytes)};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = images.find(key);
+        if (cached != images.end())
+        {
+            ++hit_count;
+            return cached->second;
+        }
+    }
+
+    // Loaded without the lock, two workers may load the same new image and the first one wins
+    std::shared_ptr<Image> image = load_image(std::move(bytes));
+    std::lock_guard<std::mutex> lock(mutex);
+    ++load_count;
+    std::erase_if(images, [&key](const auto &entry)
+                  { return entry.first.first == key.first && entry.first.second != key.second; });
+    return images.emplace(key, image).first->second;
+}
+
+std::size_t batch::ImageCache::loads() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return load_count;
+}
+
+std::size_t batch::ImageCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hit_count;
+}
+
+std::vector<fs::path> batch::read_jobs(const fs::path &file)
+{
+    std::ifstream input(file);
+    if (!input.is_open())
+        throw std::runtime_error("Cannot open jobs file " + file.string());
+    std::vector<fs::path> jobs;
+    std::string line;
+    while (std::getline(input, line))
+    {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (line.empty() || line.front() == '#')
+            continue;
+        fs::path job(line);
+        jobs.push_back(job.is_absolute() ? job : file.parent_path() / job);
+    }
+    return jobs;
+}
+
+batch::Summary batch::run(const std::vector<fs::path> &files, unsigned workers, bool debug_mode)
+{
+    if (workers == 0)
+        workers = std::max(std::thread::hardware_concurrency(), 1U);
+    Summary summary{{}, workers, std::chrono::nanoseconds(0), 0, 0, 0};
+    for (const fs::path &file : files)
+        summary.jobs.push_back({file, {}, {}, std::chrono::nanoseconds(0)});
+
+    ImageCache cache;
+    Pool pool(summary.jobs.size(), workers);
+    auto start = std::chrono::steady_clock::now();
+    pool.run([&cache, &summary, debug_mode](std::size_t job)
+             { run_job(cache, summary.jobs[job], debug_mode); });
+    summary.wall_time = std::chrono::steady_clock::now() - start;
+    summary.images_loaded = cache.loads();
+    summary.image_cache_hits = cache.hits();
+    summary.steals = pool.steals();
+    return summary;
+}
+
+void batch::write_outputs(std::ostream &output, std::ostream &errors, const Summary &summary)
+{
+    for (const Job &job : summary.jobs)
+    {
+        output << job.output;
+        if (!job.error.empty())
+            errors << job.file.string() << ": " << job.error << '\n';
+    }
+    output.flush();
+}
+
+void batch::write_summary(std::ostream &output, const Summary &summary)
+{
+    std::size_t failed = 0;
+    std::chrono::nanoseconds busy{0};
+    for (const Job &job : summary.jobs)
+    {
+        failed += job.error.empty() ? 0 : 1;
+        busy += job.wall_time;
+    }
+    double wall = seconds(summary.wall_time);
+    output << std::fixed << std::setprecision(3)
+           << "jobs          " << summary.jobs.size() << " (" << failed << " failed) on " << summary.workers << " workers, "
+           << summary.steals << " stolen\n"
+           << "wall time     " << wall * 1000 << " ms, " << (wall > 0 ? summary.jobs.size() / wall : 0.0) << " jobs/s\n"
+           << "job time      " << seconds(busy) * 1000 << " ms in total, "
+           << (summary.jobs.empty() ? 0.0 : seconds(busy) * 1000 / summary.jobs.size()) << " ms per job\n"
+           << "images        " << summary.images_loaded << " loaded, " << summary.image_cache_hits << " from cache\n"
+           << std::defaultfloat;
+}
@@ -29,9 +29,12 @@ ConstantPool::~ConstantPool()
 {
     if (data != nullptr)
     {
+        // Equal string constants of an isolate share one object
+        std::sort(data, data + size);
         for (int i = 0; i < size; ++i)
         {
-            delete data[i];
+            if (i == 0 || data[i] != data[i - 1])
+                delete data[i];
         }
         delete[] data;
     }
@@ -90,3 +93,76 @@ IntrinsicTable::~IntrinsicTable()
         delete[] functions;
     }
 }
+
+const char *vm::code::command_name(byte command)
+{
+    switch (command)
+    {
+    case Command::PUSH_CONST:
+        return "PUSH_CONST";
+    case Command::PUSH_LOCAL:
+        return "PUSH_LOCAL";
+    case Command::PUSH_GLOBAL:
+        return "PUSH_GLOBAL";
+    case Command::STORE_LOCAL:
+        return "STORE_LOCAL";
+    case Command::STORE_GLOBAL:
+        return "STORE_GLOBAL";
+    case Command::POP:
+        return "POP";
+    case Command::DUP:
+        return "DUP";
+    case Command::ADD:
+        return "ADD";
+    case Command::SUB:
+        return "SUB";
+    case Command::MUL:
+        return "MUL";
+    case Command::DIV:
+        return "DIV";
+    case Command::MOD:
+        return "MOD";
+    case Command::EQ:
+        return "EQ";
+    case Command::NEQ:
+        return "NEQ";
+    case Command::LT:
+        return "LT";
+    case Command::LE:
+        return "LE";
+    case Command::GT:
+        return "GT";
+    case Command::GTE:
+        return "GTE";
+    case Command::AND:
+        return "AND";
+    case Command::OR:
+        return "OR";
+    case Command::NOT:
+        return "NOT";
+    case Command::JMP:
+        return "JMP";
+    case Command::JMP_IF_FALSE:
+        return "JMP_IF_FALSE";
+    case Command::JMP_IF_TRUE:
+        return "JMP_IF_TRUE";
+    case Command::CALL:
+        return "CALL";
+    case Command::RET:
+        return "RET";
+    case Command::HALT:
+        return "HALT";
+    case Command::NEW_ARRAY:
+        return "NEW_ARRAY";
+    case Command::GET_ARRAY:
+        return "GET_ARRAY";
+    case Command::SET_ARRAY:
+        return "SET_ARRAY";
+    case Command::INIT_ARRAY:
+        return "INIT_ARRAY";
+    case Command::INTRINSIC_CALL:
+        return "INTRINSIC_CALL";
+    default:
+        throw InvalidBytecodeException("Unknown command " + std::to_string(command));
+    }
+}
@@ -0,0 +1,121 @@
+#include "vm.hpp"
+#include <stdexcept>
+
+using namespace vm;
+
+namespace
+{
+    runtime::Object *to_object(memory::Allocator &allocator, const embed::Value &value)
+    {
+        if (const int *number = std::get_if<int>(&value))
+            return allocator.create(runtime::Type::I32, reinterpret_cast<const byte *>(number), sizeof(int));
+        if (const u32 *number = std::get_if<u32>(&value))
+            return allocator.create(runtime::Type::USIZE, reinterpret_cast<const byte *>(number), sizeof(u32));
+        if (const std::string *text = std::get_if<std::string>(&value))
+            return allocator.create(runtime::Type::STRING, reinterpret_cast<const byte *>(text->data()), text->size());
+        throw std::invalid_argument("An argument has no value");
+    }
+
+    embed::Value to_value(const runtime::Object &object)
+    {
+        switch (object.type)
+        {
+        case runtime::Type::I32:
+            return static_cast<int>(object);
+        case runtime::Type::USIZE:
+            return static_cast<u32>(object);
+        case runtime::Type::STRING:
+            return std::string(reinterpret_cast<const char *>(object.data), object.data_size);
+        case runtime::Type::ARRAY:
+            throw std::invalid_argument("Arrays cannot be returned to the host");
+        case runtime::Type::MAP:
+            throw std::invalid_argument("Maps cannot be returned to the host");
+        default:
+            return std::monostate();
+        }
+    }
+
+    // Drops whatever a failed call left above the stack height it started with
+    void unwind(Environment &env, std::size_t height)
+    {
+        while (env.stack.size() > height)
+        {
+            env.stack.top()->links--;
+            env.stack.pop();
+        }
+    }
+}
+
+embed::Instance::Instance(std::shared_ptr<Image> image)
+    : env(std::move(image)), reader(env.image->reader())
+{
+    for (u16 i = 0; i < env.functions.size; ++i)
+        names.emplace(env.functions.functions[i].name, i);
+}
+
+embed::Instance::Instance(const fs::path &file) : Instance(load_image(file)) {}
+
+void embed::Instance::run_main()
+{
+    std::size_t height = env.stack.size();
+    try
+    {
+        vm::run(env, false);
+    }
+    catch (...)
+    {
+        unwind(env, height);
+        throw;
+    }
+    unwind(env, height);
+}
+
+u16 embed::Instance::function(std::string_view name) const
+{
+    auto found = names.find(name);
+    if (found == names.end())
+        throw std::out_of_range("No function named " + std::string(name));
+    return found->second;
+}
+
+embed::Value embed::Instance::call(u16 function, const std::vector<Value> &arguments)
+{
+    if (function >= env.functions.size)
+        throw std::out_of_range("No function with index " + std::to_string(function));
+    const code::Function &callee = env.functions.functions[function];
+    if (arguments.size() != callee.arg_count)
+        throw std::invalid_argument(callee.name + " takes " + std::to_string(callee.arg_count) + " arguments, " +
+                                    std::to_string(arguments.size()) + " given");
+
+    std::size_t height = env.stack.size();
+    Value result;
+    try
+    {
+        for (const Value &argument : arguments)
+        {
+            runtime::Object *object = to_object(env.allocator, argument);
+            object->links++;
+            env.stack.push(object);
+        }
+        vm::call(env, reader, function, false);
+        if (callee.return_type != runtime::Type::VOID && env.stack.size() > height)
+            result = to_value(*env.stack.top());
+    }
+    catch (...)
+    {
+        unwind(env, height);
+        throw;
+    }
+    unwind(env, height);
+    return result;
+}
+
+embed::Value embed::Instance::call(std::string_view name, const std::vector<Value> &arguments)
+{
+    return call(function(name), arguments);
+}
+
+Environment &embed::Instance::environment()
+{
+    return env;
+}
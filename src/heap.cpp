@@ -0,0 +1,114 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+using namespace vm;
+
+namespace
+{
+    struct Usage
+    {
+        std::size_t objects = 0;
+        std::size_t bytes = 0;
+    };
+
+    const char *type_name(runtime::Type type)
+    {
+        switch (type)
+        {
+        case runtime::Type::I32:
+            return "i32";
+        case runtime::Type::USIZE:
+            return "usize";
+        case runtime::Type::STRING:
+            return "string";
+        case runtime::Type::ARRAY:
+            return "array";
+        case runtime::Type::MAP:
+            return "map";
+        default:
+            return "void";
+        }
+    }
+
+    // Same notation as the sampling profiler, function name and absolute bytecode offset
+    std::string site_name(u32 site, const code::FunctionTable &functions)
+    {
+        std::string name = "<main>";
+        for (u16 i = 0; i < functions.size; ++i)
+        {
+            const code::Function &function = functions.functions[i];
+            if (site >= function.offset && site < function.offset + function.length)
+            {
+                name = function.name.empty() ? "func_" + std::to_string(i) : function.name;
+                break;
+            }
+        }
+        char offset[16];
+        std::snprintf(offset, sizeof(offset), "@0x%x", site);
+        return name + offset;
+    }
+
+    template <typename Key>
+    std::vector<std::pair<Key, Usage>> by_bytes(const std::map<Key, Usage> &usage)
+    {
+        std::vector<std::pair<Key, Usage>> sorted(usage.begin(), usage.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto &left, const auto &right)
+                         { return left.second.bytes > right.second.bytes; });
+        return sorted;
+    }
+}
+
+std::size_t heap::footprint(const runtime::Object &object)
+{
+    return sizeof(runtime::Object) + object.capacity();
+}
+
+void heap::write_snapshot(std::ostream &output, const Environment &env)
+{
+    std::map<u32, Usage> allocated;
+    for (const auto &[site, counter] : env.allocator.site_counters())
+        allocated[site] = {counter.allocations, counter.bytes};
+
+    Usage live;
+    std::map<runtime::Type, Usage> live_types;
+    std::map<std::pair<u32, runtime::Type>, Usage> live_sites;
+    for (const runtime::Object *object : env.allocator.objects())
+    {
+        if (object->links == 0)
+            continue;
+        std::size_t bytes = footprint(*object);
+        for (Usage *usage : {&live, &live_types[object->type], &live_sites[{object->site, object->type}]})
+        {
+            ++usage->objects;
+            usage->bytes += bytes;
+        }
+    }
+
+    output << "{\n  \"allocation_sites\": [";
+    const char *separator = "\n";
+    for (const auto &[site, usage] : by_bytes(allocated))
+    {
+        output << separator << "    {\"site\": \"" << site_name(site, env.functions) << "\", \"allocations\": " << usage.objects
+               << ", \"bytes\": " << usage.bytes << '}';
+        separator = ",\n";
+    }
+    output << "\n  ],\n"
+           << "  \"live\": {\"objects\": " << live.objects << ", \"bytes\": " << live.bytes << ", \"types\": [";
+    separator = "\n";
+    for (const auto &[type, usage] : by_bytes(live_types))
+    {
+        output << separator << "    {\"type\": \"" << type_name(type) << "\", \"objects\": " << usage.objects << ", \"bytes\": " << usage.bytes << '}';
+        separator = ",\n";
+    }
+    output << "\n  ], \"sites\": [";
+    separator = "\n";
+    for (const auto &[key, usage] : by_bytes(live_sites))
+    {
+        output << separator << "    {\"site\": \"" << site_name(key.first, env.functions) << "\", \"type\": \"" << type_name(key.second)
+               << "\", \"objects\": " << usage.objects << ", \"bytes\": " << usage.bytes << '}';
+        separator = ",\n";
+    }
+    output << "\n  ]}\n}\n";
+}
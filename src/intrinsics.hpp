@@ -0,0 +1,85 @@
+#ifndef SHELLVM_INTRINSICS
+#define SHELLVM_INTRINSICS
+
+#include "vm.hpp"
+#include <string>
+#include <vector>
+
+// Stack helpers shared by the interpreter and the intrinsics, not part of the public interface
+namespace vm::intrinsics
+{
+
+    inline void push_object(Environment &env, runtime::Object *obj)
+    {
+        obj->links++;
+        env.stack.push(obj);
+    }
+
+    inline void pop_object(Environment &env)
+    {
+        env.stack.top()->links--;
+        env.stack.pop();
+    }
+
+    // A new number object, not linked yet
+    inline runtime::Object *number(Environment &env, runtime::Type type, u32 value)
+    {
+        return env.allocator.create(type, reinterpret_cast<const byte *>(&value), sizeof(value));
+    }
+
+    // Takes the arguments of an intrinsic off the stack, the last one was on top. They stay linked
+    // until the intrinsic is done, so its allocations cannot collect them
+    class Arguments
+    {
+    public:
+        Arguments(Environment &env, std::size_t count) : values(count)
+        {
+            for (std::size_t i = count; i-- > 0;)
+            {
+                values[i] = env.stack.top();
+                env.stack.pop();
+            }
+        }
+        Arguments(const Arguments &) = delete;
+        ~Arguments()
+        {
+            for (runtime::Object *value : values)
+                value->links--;
+        }
+
+        runtime::Object *operator[](std::size_t i) const
+        {
+            return values[i];
+        }
+
+        runtime::Object *array(std::size_t i, const char *intrinsic) const
+        {
+            return of_type(i, runtime::Type::ARRAY, intrinsic, " expects an array");
+        }
+
+        runtime::Object *map(std::size_t i, const char *intrinsic) const
+        {
+            return of_type(i, runtime::Type::MAP, intrinsic, " expects a map");
+        }
+
+        std::size_t position(std::size_t i, const char *intrinsic) const
+        {
+            if (values[i]->type != runtime::Type::I32 && values[i]->type != runtime::Type::USIZE)
+                throw code::InvalidBytecodeException(std::string(intrinsic) + " expects a number");
+            return static_cast<u32>(*values[i]);
+        }
+
+    private:
+        runtime::Object *of_type(std::size_t i, runtime::Type type, const char *intrinsic, const char *expected) const
+        {
+            if (values[i]->type != type)
+                throw code::InvalidBytecodeException(intrinsic + std::string(expected));
+            return values[i];
+        }
+
+        std::vector<runtime::Object *> values;
+    };
+
+}
+
+#endif
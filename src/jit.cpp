@@ -4,12 +4,43 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
+#include <cctype>
+#include <map>
 #include <dlfcn.h>
+#include <unistd.h>
 
 using namespace vm;
 using Command = vm::code::Command;
 
-static void write_header(std::ofstream &source, const std::string &func_name)
+#ifndef SHELLVM_JIT_COMPILER
+#define SHELLVM_JIT_COMPILER "c++"
+#endif
+
+#ifndef SHELLVM_JIT_INCLUDE_DIR
+#define SHELLVM_JIT_INCLUDE_DIR "include"
+#endif
+
+#ifdef __APPLE__
+#define JIT_LINK_FLAGS "-undefined dynamic_lookup"
+#define JIT_LIBRARY_SUFFIX ".dylib"
+#else
+#define JIT_LINK_FLAGS ""
+#define JIT_LIBRARY_SUFFIX ".so"
+#endif
+
+static std::string symbol_suffix(const std::string &name)
+{
+    std::string suffix = name;
+    for (char &c : suffix)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)))
+            c = '_';
+    }
+    return suffix;
+}
+
+static void write_includes(std::ostream &source)
 {
     source << "#include \"vm.hpp\"\n"
            << "#include <vector>\n"
@@ -18,99 +49,152 @@ static void write_header(std::ofstream &source, const std::string &func_name)
            << "#include <iostream>\n"
            << "#include <functional>\n"
            << '\n'
-           << "using namespace vm;\n"
-           << '\n'
-           << "extern \"C\" void " << func_name << "(code::Reader &reader,\n"
+           << "using namespace vm;\n";
+}
+
+static void write_signature(std::ostream &source, const std::string &func_name)
+{
+    source << "extern \"C\" void " << func_name << "(code::Reader &reader,\n"
            << "    Environment &env,\n"
            << "    std::function<void(runtime::Object *)> push,\n"
            << "    std::function<void()> pop,\n"
-           << "    std::function<void(const char *, std::function<int(int &&, int &&)>, std::function<u32(u32 &&, u32 &&)>, std::function<std::string(std::string &&, std::string &&)>)> arithmetic_operation,\n"
+           << "    std::function<void(const char *, std::function<int(int &&, int &&)>, std::function<u32(u32 &&, u32 &&)>)> arithmetic_operation,\n"
            << "    std::function<void(const char *, std::function<bool(int &&, int &&)>, std::function<bool(u32 &&, u32 &&)>)> compare_operation,\n"
-           << "    std::function<void(const char *, std::function<bool(bool &&, bool &&)>)> logical_operation,\n"
-           << "    bool debug_mode)\n"
-           << "{\n";
+           << "    std::function<void(const char *, std::function<bool(bool &&, bool &&)>)> logical_operation)";
 }
 
-void jit::compile_func(code::Reader &reader, int id, code::Function &function, bool debug_mode)
+static std::string function_symbol(int id, const code::Function &function)
 {
-    std::string source_path = std::filesystem::temp_directory_path().append("jit_func_").string().append(std::to_string(id));
-    std::ofstream source(source_path + ".cpp", std::ios::trunc);
-    if (!debug_mode)
-        std::cout << "Write code to " << source_path << std::endl;
-    std::stringstream ss;
-    ss << "jit_func_" << id;
-    write_header(source, ss.str());
-    source << "std::vector<runtime::Link> local_variables(" << function.arg_count + function.local_count << ");\n";
+    return "jit_func_" + std::to_string(id) + '_' + symbol_suffix(function.name);
+}
+
+// Functions of one translation unit by index, they call each other directly
+using Unit = std::map<u16, const code::Function *>;
+
+static void write_declarations(std::ostream &source, const Unit &unit)
+{
+    for (const auto &[id, function] : unit)
+    {
+        source << '\n';
+        write_signature(source, function_symbol(id, *function));
+        source << ";\n";
+    }
+}
+
+// Translates length bytes of code from the reader position into a C++ function with locals local variables
+static void write_function(std::ostream &source, code::Reader &reader, const Unit &unit, const std::string &symbol, std::size_t length, std::size_t locals, bool debug_mode)
+{
+    source << '\n';
+    write_signature(source, symbol);
+    source << "\n{\n";
+    source << "std::vector<runtime::Link> local_variables(" << locals << ");\n";
+    source << "stats::Counters &counters = stats::local();\n";
     source << "int result;\n";
-    source << "runtime::Object *array, *index, *value, *condition_obj;\n";
-    auto write_push = [&reader, &source, debug_mode](const char *suffix, const char *getter_start, const char *getter_end)
+    source << "runtime::Object *value, *condition_obj;\n";
+    std::size_t start = reader.get_offset();
+    ranges::Analysis analysis = ranges::analyze(reader, length);
+    reader.set_offset(start);
+    std::map<std::size_t, const ranges::Loop *> headers, latches;
+    for (const ranges::Loop &loop : analysis.loops)
+    {
+        headers[loop.header] = latches[loop.latch] = &loop;
+        source << "bool in_bounds" << loop.header << " = false;\n";
+    }
+    const char *debug_flag = debug_mode ? "true" : "false";
+    auto write_trace = [&source, debug_mode](std::size_t offset, byte command, u32 operand)
     {
-        u16 index = reader.read_16();
         if (debug_mode)
-            source << "    std::cout << \"PUSH_ " << suffix << " from index \" << " << index << " << std::endl;\n";
+            source << "debug::trace(env, " << offset << ", " << (int)command << ", " << operand << ");\n";
+    };
+    auto write_push = [&reader, &source](const char *getter_start, const char *getter_end)
+    {
+        u16 index = reader.read_16();
         source << "push(" << getter_start << index << getter_end << ");\n";
+        return index;
     };
-    auto write_store = [&reader, &source, debug_mode](const char *suffix, const char *getter_start, const char *getter_end)
+    auto write_store = [&reader, &source](const char *getter_start, const char *getter_end)
     {
         u16 index = reader.read_16();
-        if (debug_mode)
-            source << "    std::cout << \"STORE_" << suffix << " to index " << index << "\" << std::endl;\n";
         source << getter_start << index << getter_end << " = env.stack.top();\n"
                << "pop();\n";
+        return index;
     };
-    auto write_jump_if = [&reader, &source, debug_mode](bool condition)
+    auto write_jump_if = [&reader, &source, &write_trace](std::size_t offset, byte command)
     {
         int length = static_cast<std::int16_t>(reader.read_16());
         source << "condition_obj = env.stack.top();\n"
                << "pop();\n";
-        if (debug_mode)
-            source << "std::cout << \"JUMP_IF_" << (condition ? "TRUE" : "FALSE") << " to " << length << "\" << std::endl;\n";
-        source << "if (" << (condition ? "true" : "false") << " == static_cast<bool>(*condition_obj))\n"
+        write_trace(offset, command, static_cast<u32>(length));
+        source << "if (" << (command == Command::JMP_IF_TRUE ? "true" : "false") << " == static_cast<bool>(*condition_obj))\n"
                << "    goto mark" << reader.get_offset() + length << ";\n";
     };
-    std::size_t start = reader.get_offset();
-    while (reader.get_offset() - start < function.length)
+    // Writes the array instruction, without checks where the loop around it was entered in bounds
+    auto write_access = [&source, &analysis](std::size_t offset, const char *function)
     {
-        source << "mark" << reader.get_offset() << ":\n";
+        auto access = analysis.accesses.find(offset);
+        if (access != analysis.accesses.end())
+            source << "if (in_bounds" << analysis.loops[access->second].header << ")\n"
+                   << "    " << function << "<false>(env);\n"
+                   << "else\n"
+                   << "    ";
+        source << function << "(env);\n";
+    };
+    while (reader.get_offset() - start < length)
+    {
+        std::size_t offset = reader.get_offset();
+        source << "mark" << offset << ":\n";
+        // The back edge of a counted loop jumps past its hoisted check
+        auto header = headers.find(offset);
+        if (header != headers.end())
+        {
+            const ranges::Loop &loop = *header->second;
+            source << "in_bounds" << offset << " = ";
+            if (loop.bound_command == Command::INTRINSIC_CALL)
+                source << "env.intrinsics.functions[" << loop.bound << "].name == \"array_length\";\n";
+            else
+                source << "proccess::loop_in_bounds(local_variables[" << loop.array << "].object, local_variables[" << loop.index << "].object, "
+                       << (loop.bound_command == Command::PUSH_CONST ? "env.constant_pool.data[" : "local_variables[") << loop.bound
+                       << (loop.bound_command == Command::PUSH_CONST ? "]" : "].object") << ", env.constant_pool.data[" << loop.step << "]);\n";
+            source << "iteration" << offset << ":\n";
+        }
+        source << "stats::add(counters.instructions);\n"
+               << "env.allocator.site = " << offset << ";\n";
         byte command = reader.read_byte();
+        u32 operand = 0;
         switch (command)
         {
         case Command::PUSH_CONST:
         {
-            write_push("CONST", "env.constant_pool.data[", "]");
+            operand = write_push("env.constant_pool.data[", "]");
             break;
         }
         case Command::PUSH_LOCAL:
         {
-            write_push("LOCAL", "local_variables[", "].object");
+            operand = write_push("local_variables[", "].object");
             break;
         }
         case Command::PUSH_GLOBAL:
         {
-            write_push("GLOBAL", "env.global.variables[", "].object");
+            operand = write_push("env.global.variables[", "].object");
             break;
         }
         case Command::STORE_LOCAL:
         {
-            write_store("LOCAL", "local_variables[", "]");
+            operand = write_store("local_variables[", "]");
             break;
         }
         case Command::STORE_GLOBAL:
         {
-            write_store("GLOBAL", "env.global.variables[", "]");
+            operand = write_store("env.global.variables[", "]");
             break;
         }
         case Command::POP:
         {
-            if (debug_mode)
-                source << "std::cout << \"POP \" << std::endl;\n";
             source << "pop();\n";
             break;
         }
         case Command::DUP:
         {
-            if (debug_mode)
-                source << "std::cout << \"DUP \" << std::endl;\n";
             source << "push(env.stack.top());\n";
             break;
         }
@@ -121,16 +205,21 @@ void jit::compile_func(code::Reader &reader, int id, code::Function &function, b
         case Command::DIV:
         case Command::MOD:
         {
+            if (command == Command::ADD && reader.get_offset() - start + 3 <= length)
+            {
+                std::size_t next = reader.get_offset();
+                byte store = reader.read_byte();
+                u16 variable = reader.read_16();
+                reader.set_offset(next);
+                if (store == Command::STORE_LOCAL)
+                    source << "env.overwritten = local_variables[" << variable << "].object;\n";
+                else if (store == Command::STORE_GLOBAL)
+                    source << "env.overwritten = env.global.variables[" << variable << "].object;\n";
+            }
             source << "arithmetic_operation(\n"
-                   << '"' << (command == Command::ADD ? "ADD" : command == Command::SUB ? "SUB"
-                                                            : command == Command::MUL   ? "MUL"
-                                                            : command == Command::DIV   ? "DIV"
-                                                                                        : "MOD")
-                   << "\",\n"
+                   << '"' << code::command_name(command) << "\",\n"
                    << "proccess::get_arithmetic_function<int>(" << (int)command << "),\n"
-                   << "proccess::get_arithmetic_function<u32>(" << (int)command << "),\n"
-                   << "[](std::string &&a, std::string &&b)\n"
-                   << "    { return a + b; });\n";
+                   << "proccess::get_arithmetic_function<u32>(" << (int)command << "));\n";
             break;
         }
 
@@ -142,12 +231,7 @@ void jit::compile_func(code::Reader &reader, int id, code::Function &function, b
         case Command::GTE:
         {
             source << "compare_operation(\n"
-                   << '"' << (command == Command::EQ ? "EQ" : command == Command::NEQ ? "NEQ"
-                                                          : command == Command::LT    ? "LT"
-                                                          : command == Command::LE    ? "LE"
-                                                          : command == Command::GT    ? "GT"
-                                                                                      : "GTE")
-                   << "\",\n"
+                   << '"' << code::command_name(command) << "\",\n"
                    << "proccess::get_comparison_function<int>(" << (int)command << "),\n"
                    << "proccess::get_comparison_function<u32>(" << (int)command << "));\n";
             break;
@@ -156,147 +240,350 @@ void jit::compile_func(code::Reader &reader, int id, code::Function &function, b
         case Command::OR:
         {
             source << "logical_operation(\n"
-                   << '"' << (command == Command::AND ? "AND" : "OR") << "\",\n"
+                   << '"' << code::command_name(command) << "\",\n"
                    << "proccess::get_logical_function(" << (int)command << "));\n";
             break;
         }
         case Command::NOT:
         {
-            source << "runtime::Object *obj = env.stack.top();\n"
+            source << "value = env.stack.top();\n"
                    << "pop();\n";
-            if (debug_mode)
-                source << "std::cout << \"Not of \" << (int)*obj << std::endl;\n";
-            source << "result = !static_cast<bool>(*obj);\n"
-                   << "push(env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), 4));";
+            source << "result = !static_cast<bool>(*value);\n"
+                   << "push(env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), 4));\n";
             break;
         }
 
         case Command::JMP:
         {
             int length = static_cast<std::int16_t>(reader.read_16());
-            if (debug_mode)
-                source << "std::cout << \"JMP to \" << " << length << " << std::endl;\n";
-            source << "goto mark" << reader.get_offset() + length << ";\n";
-            break;
+            write_trace(offset, command, static_cast<u32>(length));
+            source << "goto " << (latches.count(offset) ? "iteration" : "mark") << reader.get_offset() + length << ";\n";
+            continue;
         }
         case Command::JMP_IF_FALSE:
         case Command::JMP_IF_TRUE:
         {
-            write_jump_if(command == Command::JMP_IF_TRUE);
-            break;
+            write_jump_if(offset, command);
+            continue;
         }
         case Command::CALL:
         {
             u16 index = reader.read_16();
+            auto callee = unit.find(index);
+            if (callee != unit.end())
+            {
+                write_trace(offset, command, index);
+                source << "{\n"
+                       << "stats::add(counters.calls);\n"
+                       << "profile::CallGuard guard(" << index << ", nullptr, " << callee->second->offset << ", " << offset << ");\n"
+                       << function_symbol(index, *callee->second) << "(reader, env, push, pop, arithmetic_operation, compare_operation, logical_operation);\n"
+                       << "}\n";
+                continue;
+            }
             std::string func_name = "func" + std::to_string(reader.get_offset());
-            source << "code::Function " << func_name << " = env.functions.functions[" << index << "];\n";
-            if (debug_mode)
-                source << "std::cout << \"CALL of " << index << "\" << std::endl;";
-            source << "if (" << func_name << ".calls++ > 100)\n"
+            source << "{\n"
+                   << "code::Function &" << func_name << " = env.functions.functions[" << index << "];\n";
+            write_trace(offset, command, index);
+            source << "stats::add(counters.calls);\n"
+                   << "if (" << func_name << ".compiled_code(" << debug_flag << ").load(std::memory_order_relaxed) != nullptr || env.calls[" << index << "]++ > env.jit_threshold)\n"
                    << "{\n"
-                   << "    if (" << func_name << ".compiled == nullptr)\n"
-                   << "    {\n"
-                   << "        reader.set_offset(" << func_name << ".offset);\n"
-                   << "        jit::compile_func(reader, " << index << ", " << func_name << ", debug_mode);\n"
-                   << "    }\n"
-                   << "    reinterpret_cast<proccess::jit_function *>(" << func_name << ".compiled)(reader, env, push, pop, arithmetic_operation, compare_operation, logical_operation, debug_mode);\n"
+                   << "    void *compiled = jit::compiled(env, reader, " << index << ", " << debug_flag << ");\n"
+                   << "    profile::CallGuard guard(" << index << ", nullptr, " << func_name << ".offset, " << offset << ");\n"
+                   << "    reinterpret_cast<proccess::jit_function *>(compiled)(reader, env, push, pop, arithmetic_operation, compare_operation, logical_operation);\n"
                    << "}\n"
                    << "else\n"
                    << "{\n"
                    << "    reader.set_offset(" << func_name << ".offset);\n"
-                   << "    process(reader, env, " << func_name << ".length, " << func_name << ".local_count + " << func_name << ".arg_count, debug_mode);\n"
+                   << "    profile::CallGuard guard(" << index << ", &reader, " << func_name << ".offset, " << offset << ");\n"
+                   << "    process(reader, env, " << func_name << ".length, " << func_name << ".local_count + " << func_name << ".arg_count, " << debug_flag << ");\n"
+                   << "}\n"
                    << "}\n";
-            break;
+            continue;
         }
         case Command::RET:
         {
-            if (debug_mode)
-                source << "std::cout << \"RET\" << std::endl;\n";
+            write_trace(offset, command, operand);
             source << "return;\n";
-            break;
+            continue;
         }
         case Command::HALT:
         {
-            if (debug_mode)
-                source << "std::cout << \"HALT\" << std::endl;";
+            write_trace(offset, command, operand);
             source << "throw runtime::HaltException(\"HALT command found in bytecode!\");\n";
-            break;
+            continue;
         }
 
         case Command::NEW_ARRAY:
         {
             u32 size = reader.read_32();
-            reader.skip(1U);
-            if (debug_mode)
-                source << "std::cout << \"NEW_ARRAY of " << size << " elements" << "\" << std::endl;\n";
-            source << "push(env.allocator.create(runtime::Type::ARRAY, nullptr, " << size << "));\n";
+            operand = size;
+            byte element = reader.read_byte();
+            source << "push(env.allocator.create_array(" << size << ", static_cast<runtime::Type>(" << (int)element << ")));\n";
             break;
         }
         case Command::GET_ARRAY:
         {
-            source << "index = env.stack.top();\n"
-                   << "pop();\n"
-                   << "array = env.stack.top();\n"
-                   << "pop();\n";
-            if (debug_mode)
-                source << "std::cout << \"GET_ARRAY in \" << (int)*index << std::endl;\n";
-            source << "push(reinterpret_cast<runtime::Link *>(array->data)[static_cast<u32>(*index)].object);\n";
+            write_access(offset, "proccess::get_array");
             break;
         }
         case Command::SET_ARRAY:
         {
-            source << "index = env.stack.top();\n"
-                   << "pop();\n"
-                   << "value = env.stack.top();\n"
-                   << "pop();\n"
-                   << "array = env.stack.top();\n"
-                   << "pop();\n";
-            if (debug_mode)
-                source << "std::cout << \"SET_ARRAY in \" << static_cast<u32>(*index) << \" with \" << static_cast<int>(*value) << std::endl;";
-            source << "reinterpret_cast<runtime::Link *>(array->data)[static_cast<u32>(*index)] = value;";
+            write_access(offset, "proccess::set_array");
             break;
         }
         case Command::INIT_ARRAY:
         {
             u16 size = reader.read_16();
-            if (debug_mode)
-                source << "std::cout << \"INIT_ARRAY of size " << size << "\" << std::endl;";
-
-            source << "runtime::Object *objects" << reader.get_offset() << "[" << size << "];\n"
-                   << "for (u16 i = 0; i < " << size << "; ++i)\n"
-                   << "{\n"
-                   << "    objects" << reader.get_offset() << "[i] = env.stack.top();\n"
-                   << "    pop();\n"
-                   << "}\n"
-                   << "array = env.stack.top();\n"
-                   << "pop();\n"
-                   << "for (u16 i = 0; i < " << size << "; ++i)\n"
-                   << "{\n"
-                   << "    reinterpret_cast<runtime::Link *>(array->data)[i] = objects" << reader.get_offset() << "[i];\n"
-                   << "}\n"
-                   << "push(array);\n";
+            operand = size;
+            source << "proccess::init_array(env, " << size << ");\n";
             break;
         }
         case Command::INTRINSIC_CALL:
         {
             u16 index = reader.read_16();
-            if (debug_mode)
-                source << "std::cout << \"INTRINSIC_CALL of " << index << "\" <<  std::endl;\n";
+            write_trace(offset, command, index);
+            source << "proccess::call_intrinsic<" << debug_flag << ">(" << index << ", env);\n";
+            continue;
+        }
+        }
+        write_trace(offset, command, operand);
+    }
+    // Jumps may target the end of the code
+    source << "mark" << start + length << ":;\n"
+           << "}\n";
+}
+
+// Symbols of the VM are resolved against the host executable, which exports them
+static bool build_library(const std::string &source, const std::string &library)
+{
+    std::string compiler = SHELLVM_JIT_COMPILER;
+    return system((compiler + " -std=c++20 -O2 -c -fPIC -I " SHELLVM_JIT_INCLUDE_DIR " -o " + source + ".o " + source).c_str()) == 0 &&
+           system((compiler + " -shared " JIT_LINK_FLAGS " -o " + library + " " + source + ".o").c_str()) == 0;
+}
 
-            source << "proccess::call_intrinsic(" << index << ", env, debug_mode);\n";
+// Every function of the unit must be readable from reader, which is left at an unspecified offset
+static void compile_unit(code::Reader &reader, const Unit &unit, bool debug_mode, std::ostream *log)
+{
+    auto compile_start = std::chrono::steady_clock::now();
+    phases::Scope scope(phases::JIT_COMPILE);
+    // A loaded shared object must never be overwritten, so every compilation gets its own files
+    static std::atomic<std::size_t> compilations = 0;
+    std::string source_path = std::filesystem::temp_directory_path().append("jit_func_").string() +
+                              std::to_string(getpid()) + '_' + std::to_string(compilations++) + '_' + std::to_string(unit.begin()->first);
+    std::ofstream source(source_path + ".cpp", std::ios::trunc);
+    if (debug_mode && log != nullptr)
+        *log << "Write code to " << source_path << std::endl;
+    write_includes(source);
+    write_declarations(source, unit);
+    for (const auto &[id, function] : unit)
+    {
+        reader.set_offset(function->offset);
+        write_function(source, reader, unit, function_symbol(id, *function), function->length, function->arg_count + function->local_count, debug_mode);
+    }
+    source.close();
+
+    if (debug_mode && log != nullptr)
+        *log << "Compile generated code" << std::endl;
+
+    std::string library = source_path + JIT_LIBRARY_SUFFIX;
+    bool built = build_library(source_path + ".cpp", library);
+    std::error_code ignored;
+    fs::remove(source_path + ".cpp", ignored);
+    fs::remove(source_path + ".cpp.o", ignored);
+    if (!built)
+    {
+        fs::remove(library, ignored);
+        stats::add(stats::local().jit_failures);
+        throw std::runtime_error("JIT compilation of function " + std::to_string(unit.begin()->first) + " failed");
+    }
+
+    // The mapping stays valid once the file is gone
+    auto lib = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    fs::remove(library, ignored);
+    if (lib == nullptr)
+    {
+        stats::add(stats::local().jit_failures);
+        throw std::runtime_error(dlerror());
+    }
+    // Published only once all of them are resolved, so no isolate calls into a half loaded batch
+    std::vector<void *> symbols;
+    for (const auto &[id, function] : unit)
+        symbols.push_back(dlsym(lib, function_symbol(id, *function).c_str()));
+    auto compiled = symbols.begin();
+    for (const auto &[id, function] : unit)
+    {
+        std::stringstream name;
+        name << "snaill::" << function->name << " [bytecode 0x" << std::hex << function->offset << "-0x" << function->offset + function->length << ']';
+        perf::register_code(*compiled, name.str());
+        const_cast<code::Function *>(function)->compiled_code(debug_mode).store(*compiled++, std::memory_order_release);
+    }
+
+    stats::Counters &counters = stats::local();
+    stats::add(counters.jit_compilations);
+    stats::add(counters.jit_functions, unit.size());
+    counters.jit_compile.record(std::chrono::steady_clock::now() - compile_start);
+}
+
+void jit::compile_func(code::Reader &reader, int id, code::Function &function, bool debug_mode, std::ostream *log)
+{
+    compile_unit(reader, {{static_cast<u16>(id), &function}}, debug_mode, log);
+}
+
+void jit::compile_batch(code::Reader &reader, code::FunctionTable &functions, const std::vector<u16> &indexes, bool debug_mode, std::ostream *log)
+{
+    Unit unit;
+    for (u16 index : indexes)
+        unit.emplace(index, &functions.functions[index]);
+    if (!unit.empty())
+        compile_unit(reader, unit, debug_mode, log);
+}
+
+// Indexes of the functions called from the bytecode of the function
+static std::vector<u16> callees(code::Reader &reader, const code::Function &function)
+{
+    std::vector<u16> called;
+    reader.set_offset(function.offset);
+    while (reader.get_offset() < function.offset + function.length)
+    {
+        switch (reader.read_byte())
+        {
+        case Command::CALL:
+            called.push_back(reader.read_16());
+            break;
+        case Command::PUSH_CONST:
+        case Command::PUSH_LOCAL:
+        case Command::PUSH_GLOBAL:
+        case Command::STORE_LOCAL:
+        case Command::STORE_GLOBAL:
+        case Command::INIT_ARRAY:
+        case Command::INTRINSIC_CALL:
+        case Command::JMP:
+        case Command::JMP_IF_FALSE:
+        case Command::JMP_IF_TRUE:
+            reader.skip(2U);
+            break;
+        case Command::NEW_ARRAY:
+            reader.skip(5U);
             break;
         }
+    }
+    return called;
+}
+
+std::vector<u16> jit::select_batch(Environment &env, code::Reader &reader, u16 index, bool debug_mode)
+{
+    const code::FunctionTable &functions = env.functions;
+    std::vector<bool> selected(functions.size);
+    std::vector<u16> batch{index};
+    selected[index] = true;
+    auto eligible = [&functions, &selected, debug_mode](u16 candidate)
+    {
+        return candidate < functions.size && !selected[candidate] &&
+               functions.functions[candidate].compiled_code(debug_mode).load(std::memory_order_acquire) == nullptr;
+    };
+    for (std::size_t next = 0; next < batch.size() && batch.size() < BATCH_LIMIT; ++next)
+    {
+        for (u16 callee : callees(reader, functions.functions[batch[next]]))
+        {
+            if (batch.size() < BATCH_LIMIT && eligible(callee) && env.calls[callee] > 0)
+            {
+                selected[callee] = true;
+                batch.push_back(callee);
+            }
         }
     }
-    source << "}\n";
+    for (u16 i = 0; i < functions.size && batch.size() < BATCH_LIMIT; ++i)
+    {
+        if (eligible(i) && env.calls[i] > env.jit_threshold / 2)
+        {
+            selected[i] = true;
+            batch.push_back(i);
+        }
+    }
+    return batch;
+}
+
+void *jit::compiled(Environment &env, code::Reader &reader, u16 index, bool debug_mode)
+{
+    code::Function &function = env.functions.functions[index];
+    std::atomic<void *> &slot = function.compiled_code(debug_mode);
+    void *compiled = slot.load(std::memory_order_acquire);
+    if (compiled != nullptr)
+        return compiled;
+
+    // Isolates that get hot at the same time wait for the first one instead of compiling again
+    std::lock_guard<std::mutex> lock(env.image->jit_mutex);
+    compiled = slot.load(std::memory_order_acquire);
+    if (compiled == nullptr)
+    {
+        // The tracer writes to the same stream from a thread of its own
+        if (debug_mode && env.tracer != nullptr)
+            env.tracer->flush();
+        compile_batch(reader, env.functions, select_batch(env, reader, index, debug_mode), debug_mode, env.output);
+        compiled = slot.load(std::memory_order_acquire);
+    }
+    return compiled;
+}
+
+void jit::compile_program(const Image &image, const fs::path &library)
+{
+    if (!image.bytes)
+        throw std::logic_error("Ahead-of-time compilation needs an image loaded with its bytes");
+    std::string source_path = library.string() + ".cpp";
+    std::ofstream source(source_path, std::ios::trunc);
+    Unit unit;
+    for (u16 i = 0; i < image.functions.size; ++i)
+        unit.emplace(i, &image.functions.functions[i]);
+    write_includes(source);
+    source << "\nextern \"C\" const std::uint64_t shellvm_aot_hash = " << content_hash(*image.bytes) << "ULL;\n"
+           << "extern \"C\" const u16 shellvm_aot_functions = " << image.functions.size << ";\n";
+    write_declarations(source, unit);
+    code::Reader reader = image.reader();
+    for (const auto &[id, function] : unit)
+    {
+        reader.set_offset(function->offset);
+        write_function(source, reader, unit, function_symbol(id, *function), function->length, function->arg_count + function->local_count, false);
+    }
+    reader.set_offset(image.body_offset);
+    write_function(source, reader, unit, "aot_main", image.body_length, 0, false);
     source.close();
 
-    if (debug_mode)
-        std::cout << "Compile generated code" << std::endl;
+    bool built = build_library(source_path, library.string());
+    std::error_code ignored;
+    fs::remove(source_path, ignored);
+    fs::remove(source_path + ".o", ignored);
+    if (!built)
+        throw std::runtime_error("Ahead-of-time compilation to " + library.string() + " failed");
+}
 
-    system(("clang++ -std=c++20 -c -fPIC -I /Users/alexey/SnailL-dev/vm/include -o " + source_path + ".o " + source_path + ".cpp").c_str());
-    system(("clang++ -shared -L/Users/alexey/SnailL-dev/build -lvm -o " + source_path + ".dylib " + source_path + ".o").c_str());
+bool jit::load_program(Image &image, const fs::path &library, std::ostream &warnings)
+{
+    void *lib = dlopen(fs::absolute(library).c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (lib == nullptr)
+    {
+        warnings << "Cannot load " << library.string() << ", interpreting: " << dlerror() << '\n';
+        return false;
+    }
+    auto hash = static_cast<const std::uint64_t *>(dlsym(lib, "shellvm_aot_hash"));
+    auto functions = static_cast<const u16 *>(dlsym(lib, "shellvm_aot_functions"));
+    if (hash == nullptr || functions == nullptr || !image.bytes || *hash != content_hash(*image.bytes) ||
+        *functions != image.functions.size)
+    {
+        warnings << library.string() << " was compiled from other bytecode, interpreting\n";
+        dlclose(lib);
+        return false;
+    }
 
-    auto lib = dlopen((source_path + ".dylib").c_str(), RTLD_NOW | RTLD_LOCAL);
-    function.compiled = dlsym(lib, ss.str().c_str());
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(image.jit_mutex);
+    for (u16 i = 0; i < image.functions.size; ++i)
+    {
+        code::Function &function = image.functions.functions[i];
+        void *compiled = dlsym(lib, function_symbol(i, function).c_str());
+        std::stringstream name;
+        name << "snaill::" << function.name << " [bytecode 0x" << std::hex << function.offset << "-0x" << function.offset + function.length << ']';
+        perf::register_code(compiled, name.str());
+        function.compiled.store(compiled, std::memory_order_release);
+    }
+    image.compiled_main = dlsym(lib, "aot_main");
+    return true;
+}
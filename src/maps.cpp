@@ -0,0 +1,102 @@
+#include "vm.hpp"
+#include "intrinsics.hpp"
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace vm;
+using namespace vm::intrinsics;
+
+namespace
+{
+    void create(Environment &env)
+    {
+        push_object(env, env.allocator.create(runtime::Type::MAP, nullptr, 0));
+    }
+
+    void put(Environment &env)
+    {
+        Arguments arguments(env, 3);
+        runtime::Object *table = arguments.map(0, "map_put");
+        table->map().put(arguments[1], arguments[2]);
+        table->data_size = table->map().size();
+    }
+
+    void get(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *table = arguments.map(0, "map_get");
+        runtime::Object *value = table->map().find(arguments[1]);
+        if (value == nullptr)
+            throw code::InvalidBytecodeException("map_get of a missing key");
+        push_object(env, value);
+    }
+
+    // map_get_or(map, key, fallback) spares programs a map_contains before every lookup
+    void get_or(Environment &env)
+    {
+        Arguments arguments(env, 3);
+        runtime::Object *table = arguments.map(0, "map_get_or");
+        runtime::Object *value = table->map().find(arguments[1]);
+        push_object(env, value == nullptr ? arguments[2] : value);
+    }
+
+    void contains(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *table = arguments.map(0, "map_contains");
+        bool found = table->map().find(arguments[1]) != nullptr;
+        push_object(env, number(env, runtime::Type::I32, found ? 1 : 0));
+    }
+
+    void remove(Environment &env)
+    {
+        Arguments arguments(env, 2);
+        runtime::Object *table = arguments.map(0, "map_remove");
+        bool removed = table->map().remove(arguments[1]);
+        table->data_size = table->map().size();
+        push_object(env, number(env, runtime::Type::I32, removed ? 1 : 0));
+    }
+
+    void size(Environment &env)
+    {
+        Arguments arguments(env, 1);
+        runtime::Object *table = arguments.map(0, "map_size");
+        push_object(env, number(env, runtime::Type::USIZE, static_cast<u32>(table->data_size)));
+    }
+
+    // The keys in slot order, which is the order the map prints in
+    void keys(Environment &env)
+    {
+        Arguments arguments(env, 1);
+        runtime::Object *table = arguments.map(0, "map_keys");
+        const runtime::Map &map = table->map();
+        runtime::Object *array = env.allocator.create_array(map.size(), runtime::Type::VOID);
+        runtime::Link *elements = reinterpret_cast<runtime::Link *>(array->data);
+        std::size_t i = 0;
+        for (std::size_t slot = map.next(0); slot < map.slots(); slot = map.next(slot + 1))
+        {
+            runtime::Object *key = map.key(slot);
+            elements[i++] = key;
+        }
+        push_object(env, array);
+    }
+}
+
+bool maps::call(const std::string &name, Environment &env)
+{
+    static const std::unordered_map<std::string, void (*)(Environment &)> intrinsics{
+        {"map_new", create},
+        {"map_put", put},
+        {"map_get", get},
+        {"map_get_or", get_or},
+        {"map_contains", contains},
+        {"map_remove", remove},
+        {"map_size", size},
+        {"map_keys", keys},
+    };
+    auto intrinsic = intrinsics.find(name);
+    if (intrinsic == intrinsics.end())
+        return false;
+    intrinsic->second(env);
+    return true;
+}
@@ -0,0 +1,140 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <streambuf>
+
+using namespace vm;
+
+namespace
+{
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override
+        {
+            return c;
+        }
+
+        std::streamsize xsputn(const char *, std::streamsize count) override
+        {
+            return count;
+        }
+    };
+
+    // Puts the loaded image back into the state it had right after load
+    void reset(Environment &env, bool reset_jit)
+    {
+        while (!env.stack.empty())
+        {
+            env.stack.top()->links--;
+            env.stack.pop();
+        }
+        for (u16 i = 0; i < env.global.size; ++i)
+        {
+            runtime::Link &global = env.global.variables[i];
+            if (global.object != nullptr)
+                --global.object->links;
+            global.object = nullptr;
+        }
+        if (reset_jit)
+        {
+            std::fill(env.calls.begin(), env.calls.end(), 0);
+            for (u16 i = 0; i < env.functions.size; ++i)
+            {
+                env.functions.functions[i].compiled = nullptr;
+                env.functions.functions[i].compiled_debug = nullptr;
+            }
+        }
+    }
+
+    double milliseconds(std::chrono::nanoseconds duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    // Nearest-rank percentile of sorted durations
+    std::chrono::nanoseconds percentile(const std::vector<std::chrono::nanoseconds> &sorted, double rank)
+    {
+        std::size_t index = static_cast<std::size_t>(std::ceil(rank * sorted.size()));
+        return sorted[std::clamp<std::size_t>(index, 1, sorted.size()) - 1];
+    }
+}
+
+measure::Report measure::run(const fs::path &file, const Options &options)
+{
+    std::shared_ptr<Image> image = load_image(file);
+    if (!options.native_library.empty())
+        jit::load_program(*image, options.native_library, std::cerr);
+    Environment env(image);
+
+    NullBuffer null;
+    std::ostream discard(&null);
+    env.output = &discard;
+
+    Report report{options.bench_warmup, options.bench_reset_jit, {}};
+    for (unsigned i = 0; i < options.bench_warmup + options.bench_runs; ++i)
+    {
+        reset(env, options.bench_reset_jit);
+        std::size_t instructions = stats::local().instructions.load(std::memory_order_relaxed);
+        env.allocator.reset_statistics();
+
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            vm::run(env, options.debug_mode);
+        }
+        catch (const runtime::HaltException &)
+        {
+        }
+        auto wall_time = std::chrono::steady_clock::now() - start;
+
+        if (i < options.bench_warmup)
+            continue;
+        const memory::Allocator::Statistics &stats = env.allocator.statistics();
+        report.runs.push_back({wall_time,
+                               stats::local().instructions.load(std::memory_order_relaxed) - instructions,
+                               stats.allocations,
+                               stats.collections,
+                               stats.collection_time,
+                               stats.longest_collection});
+    }
+    reset(env, false);
+    return report;
+}
+
+void measure::write_report(std::ostream &output, const Report &report)
+{
+    if (report.runs.empty())
+        return;
+
+    std::vector<std::chrono::nanoseconds> wall_times;
+    Run total{};
+    for (const Run &run : report.runs)
+    {
+        wall_times.push_back(run.wall_time);
+        total.instructions += run.instructions;
+        total.allocations += run.allocations;
+        total.collections += run.collections;
+        total.collection_time += run.collection_time;
+        total.longest_collection = std::max(total.longest_collection, run.longest_collection);
+    }
+    std::sort(wall_times.begin(), wall_times.end());
+    std::size_t count = report.runs.size();
+    std::chrono::nanoseconds median = count % 2 == 1
+                                          ? wall_times[count / 2]
+                                          : (wall_times[count / 2 - 1] + wall_times[count / 2]) / 2;
+
+    output << std::fixed << std::setprecision(3)
+           << "runs          " << count << " (" << report.warmup << " warmup, JIT state "
+           << (report.reset_jit ? "reset" : "kept") << " between runs)\n"
+           << "wall time     min " << milliseconds(wall_times.front()) << " ms, median " << milliseconds(median)
+           << " ms, p99 " << milliseconds(percentile(wall_times, 0.99)) << " ms\n"
+           << "instructions  " << total.instructions / count << " per run\n"
+           << "allocations   " << total.allocations / count << " per run\n"
+           << "gc pauses     " << total.collections / count << " per run, "
+           << milliseconds(total.collection_time / count) << " ms per run, longest "
+           << milliseconds(total.longest_collection) << " ms\n"
+           << std::defaultfloat;
+}
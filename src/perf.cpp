@@ -0,0 +1,179 @@
+#include "vm.hpp"
+
+#ifdef __linux__
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace vm;
+
+namespace
+{
+    constexpr u32 JITDUMP_MAGIC = 0x4A695444;
+    constexpr u32 JITDUMP_VERSION = 1;
+    constexpr u32 JIT_CODE_LOAD = 0;
+    constexpr u32 JIT_CODE_CLOSE = 3;
+
+    struct JitdumpHeader
+    {
+        u32 magic;
+        u32 version;
+        u32 total_size;
+        u32 elf_mach;
+        u32 pad1;
+        u32 pid;
+        std::uint64_t timestamp;
+        std::uint64_t flags;
+    };
+
+    struct RecordHeader
+    {
+        u32 id;
+        u32 total_size;
+        std::uint64_t timestamp;
+    };
+
+    struct CodeLoadRecord
+    {
+        RecordHeader header;
+        u32 pid;
+        u32 tid;
+        std::uint64_t vma;
+        std::uint64_t code_addr;
+        std::uint64_t code_size;
+        std::uint64_t code_index;
+    };
+
+    std::mutex perf_mutex;
+    std::FILE *map_file = nullptr;
+    std::FILE *jitdump_file = nullptr;
+    void *jitdump_marker = nullptr;
+    std::uint64_t code_index = 0;
+
+    // perf record -k mono correlates jitdump records with samples by CLOCK_MONOTONIC
+    std::uint64_t timestamp()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    std::size_t code_size(const void *code)
+    {
+        Dl_info info;
+        ElfW(Sym) *symbol = nullptr;
+        if (dladdr1(code, &info, reinterpret_cast<void **>(&symbol), RTLD_DL_SYMENT) == 0 || symbol == nullptr)
+            return 0;
+        return symbol->st_size;
+    }
+}
+
+void perf::open_map()
+{
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    if (map_file != nullptr)
+        return;
+    std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    map_file = std::fopen(path.c_str(), "a");
+}
+
+void perf::open_jitdump()
+{
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    if (jitdump_file != nullptr)
+        return;
+
+    const char *directory = std::getenv("JITDUMPDIR");
+    std::string path = std::string(directory != nullptr ? directory : "/tmp") + "/jit-" + std::to_string(getpid()) + ".dump";
+    int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        return;
+
+    // perf only picks the dump up when it sees an executable mapping of the file
+    jitdump_marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (jitdump_marker == MAP_FAILED)
+    {
+        jitdump_marker = nullptr;
+        ::close(fd);
+        return;
+    }
+    jitdump_file = fdopen(fd, "wb");
+
+    JitdumpHeader header{JITDUMP_MAGIC, JITDUMP_VERSION, sizeof(JitdumpHeader), EM_X86_64, 0, static_cast<u32>(getpid()), timestamp(), 0};
+#if defined(__aarch64__)
+    header.elf_mach = EM_AARCH64;
+#endif
+    std::fwrite(&header, sizeof(header), 1, jitdump_file);
+    std::fflush(jitdump_file);
+}
+
+void perf::register_code(const void *code, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    if (code == nullptr || (map_file == nullptr && jitdump_file == nullptr))
+        return;
+
+    std::size_t size = code_size(code);
+    if (map_file != nullptr)
+    {
+        std::fprintf(map_file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(code), size, name.c_str());
+        std::fflush(map_file);
+    }
+    if (jitdump_file != nullptr)
+    {
+        CodeLoadRecord record;
+        record.header = {JIT_CODE_LOAD, static_cast<u32>(sizeof(record) + name.size() + 1 + size), timestamp()};
+        record.pid = static_cast<u32>(getpid());
+        record.tid = static_cast<u32>(syscall(SYS_gettid));
+        record.vma = reinterpret_cast<std::uint64_t>(code);
+        record.code_addr = record.vma;
+        record.code_size = size;
+        record.code_index = code_index++;
+        std::fwrite(&record, sizeof(record), 1, jitdump_file);
+        std::fwrite(name.c_str(), name.size() + 1, 1, jitdump_file);
+        std::fwrite(code, size, 1, jitdump_file);
+        std::fflush(jitdump_file);
+    }
+}
+
+void perf::close()
+{
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    if (map_file != nullptr)
+    {
+        std::fclose(map_file);
+        map_file = nullptr;
+    }
+    if (jitdump_file != nullptr)
+    {
+        RecordHeader record{JIT_CODE_CLOSE, sizeof(RecordHeader), timestamp()};
+        std::fwrite(&record, sizeof(record), 1, jitdump_file);
+        std::fclose(jitdump_file);
+        jitdump_file = nullptr;
+        munmap(jitdump_marker, sysconf(_SC_PAGESIZE));
+        jitdump_marker = nullptr;
+    }
+}
+
+#else
+
+void vm::perf::open_map() {}
+
+void vm::perf::open_jitdump() {}
+
+void vm::perf::register_code(const void *, const std::string &) {}
+
+void vm::perf::close() {}
+
+#endif
@@ -0,0 +1,212 @@
+#include "vm.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace vm;
+
+namespace
+{
+    constexpr std::size_t EVENTS = 4;
+    constexpr const char *PHASE_NAMES[phases::PHASES] = {"load", "interpret", "jit compile", "gc"};
+
+    struct Totals
+    {
+        std::size_t entries = 0;
+        std::chrono::nanoseconds wall_time{0};
+        std::uint64_t events[EVENTS] = {};
+    };
+
+    struct Reading
+    {
+        std::chrono::steady_clock::time_point time;
+        std::uint64_t events[EVENTS] = {};
+    };
+
+    // One counter group per thread, the time between two scope boundaries
+    // is attributed to the innermost open phase
+    struct ThreadState
+    {
+        int group = -1;
+        int descriptors[EVENTS] = {-1, -1, -1, -1};
+        std::uint64_t ids[EVENTS] = {};
+        Reading last;
+        std::vector<phases::Phase> open;
+        Totals totals[phases::PHASES];
+    };
+
+    thread_local ThreadState *state = nullptr;
+    std::mutex states_mutex;
+    std::vector<ThreadState *> states;
+    std::string unavailable;
+
+#ifdef __linux__
+    constexpr std::uint64_t EVENT_CONFIGS[EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    int open_event(std::uint64_t config, int group)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+    }
+
+    bool open_group(ThreadState &thread)
+    {
+        for (std::size_t i = 0; i < EVENTS; ++i)
+        {
+            thread.descriptors[i] = open_event(EVENT_CONFIGS[i], thread.group);
+            if (thread.descriptors[i] < 0 && i == 0)
+            {
+                unavailable = std::strerror(errno);
+                return false;
+            }
+            if (i == 0)
+                thread.group = thread.descriptors[0];
+            if (thread.descriptors[i] >= 0)
+                ioctl(thread.descriptors[i], PERF_EVENT_IOC_ID, &thread.ids[i]);
+        }
+        ioctl(thread.group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(thread.group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    // Values are scaled by enabled / running time in case the kernel multiplexed the group
+    void read_events(const ThreadState &thread, std::uint64_t *events)
+    {
+        if (thread.group < 0)
+            return;
+        std::uint64_t buffer[3 + 2 * EVENTS];
+        if (::read(thread.group, buffer, sizeof(buffer)) < 0)
+            return;
+        std::uint64_t count = buffer[0], enabled = buffer[1], running = buffer[2];
+        for (std::uint64_t i = 0; i < count; ++i)
+        {
+            std::uint64_t value = buffer[3 + 2 * i], id = buffer[4 + 2 * i];
+            if (running > 0 && running < enabled)
+                value = static_cast<std::uint64_t>(static_cast<double>(value) * enabled / running);
+            for (std::size_t event = 0; event < EVENTS; ++event)
+            {
+                if (thread.descriptors[event] >= 0 && thread.ids[event] == id)
+                    events[event] = value;
+            }
+        }
+    }
+#else
+    bool open_group(ThreadState &)
+    {
+        unavailable = "perf_event_open is only available on Linux";
+        return false;
+    }
+
+    void read_events(const ThreadState &, std::uint64_t *) {}
+#endif
+
+    void attribute(ThreadState &thread)
+    {
+        Reading now;
+        now.time = std::chrono::steady_clock::now();
+        read_events(thread, now.events);
+        if (!thread.open.empty())
+        {
+            Totals &totals = thread.totals[thread.open.back()];
+            totals.wall_time += now.time - thread.last.time;
+            for (std::size_t i = 0; i < EVENTS; ++i)
+                totals.events[i] += now.events[i] - thread.last.events[i];
+        }
+        thread.last = now;
+    }
+}
+
+phases::Scope::Scope(Phase phase) : active(state != nullptr)
+{
+    if (!active)
+        return;
+    attribute(*state);
+    state->open.push_back(phase);
+    ++state->totals[phase].entries;
+}
+
+phases::Scope::~Scope()
+{
+    if (!active)
+        return;
+    attribute(*state);
+    state->open.pop_back();
+}
+
+bool phases::enable()
+{
+    if (state == nullptr)
+    {
+        state = new ThreadState;
+        open_group(*state);
+        state->last.time = std::chrono::steady_clock::now();
+        read_events(*state, state->last.events);
+        std::lock_guard<std::mutex> lock(states_mutex);
+        states.push_back(state);
+    }
+    return state->group >= 0;
+}
+
+void phases::write_report(std::ostream &output)
+{
+    std::lock_guard<std::mutex> lock(states_mutex);
+    Totals totals[PHASES];
+    bool hardware = false;
+    for (const ThreadState *thread : states)
+    {
+        hardware = hardware || thread->group >= 0;
+        for (std::size_t phase = 0; phase < PHASES; ++phase)
+        {
+            totals[phase].entries += thread->totals[phase].entries;
+            totals[phase].wall_time += thread->totals[phase].wall_time;
+            for (std::size_t i = 0; i < EVENTS; ++i)
+                totals[phase].events[i] += thread->totals[phase].events[i];
+        }
+    }
+
+    if (!hardware)
+        output << "hardware counters unavailable (" << unavailable << "), reporting wall time only\n";
+    output << std::left << std::setw(13) << "phase" << std::right << std::setw(10) << "entries" << std::setw(12) << "wall ms";
+    if (hardware)
+        output << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC"
+               << std::setw(14) << "cache misses" << std::setw(15) << "branch misses";
+    output << '\n';
+
+    for (std::size_t phase = 0; phase < PHASES; ++phase)
+    {
+        const Totals &total = totals[phase];
+        output << std::left << std::setw(13) << PHASE_NAMES[phase] << std::right << std::setw(10) << total.entries
+               << std::setw(12) << std::fixed << std::setprecision(3)
+               << std::chrono::duration<double, std::milli>(total.wall_time).count();
+        if (hardware)
+        {
+            double ipc = total.events[0] == 0 ? 0.0 : static_cast<double>(total.events[1]) / total.events[0];
+            output << std::setw(16) << total.events[0] << std::setw(16) << total.events[1]
+                   << std::setw(7) << std::setprecision(2) << ipc
+                   << std::setw(14) << total.events[2] << std::setw(15) << total.events[3];
+        }
+        output << '\n';
+    }
+    output << std::defaultfloat;
+}
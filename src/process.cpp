@@ -1,11 +1,19 @@
 #include "vm.hpp"
+#include "intrinsics.hpp"
 #include <vector>
 #include <stack>
 #include <string>
 #include <iostream>
 #include <functional>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <stdexcept>
 
 using namespace vm;
+using vm::intrinsics::pop_object;
+using vm::intrinsics::push_object;
 using Command = vm::code::Command;
 
 static code::Header parse_header(code::Reader &reader)
@@ -29,181 +37,279 @@ class Intrinsic
 {
 public:
     constexpr static const char *PRINTLN = "println";
+    constexpr static const char *SNAPSHOT = "snapshot";
+    constexpr static const char *INTERN = "intern";
 };
 
-void proccess::call_intrinsic(u16 index, Environment &env, bool debug_mode)
+template <bool Debug>
+void proccess::call_intrinsic(u16 index, Environment &env)
 {
     if (env.intrinsics.functions[index].name == Intrinsic::PRINTLN)
     {
-        if (debug_mode)
-            std::cout << "=====================================" << std::endl;
-        if (debug_mode)
-            std::cout << "Output:" << std::endl;
-        std::cout << static_cast<std::string>(*env.stack.top()) << std::endl;
-        if (debug_mode)
-            std::cout << "=====================================" << std::endl;
+        if constexpr (Debug)
+        {
+            env.tracer->flush();
+            *env.output << "=====================================" << std::endl;
+            *env.output << "Output:" << std::endl;
+        }
+        env.buffer.clear();
+        env.stack.top()->format(env.buffer);
+        env.buffer.push_back('\n');
+        env.output->write(env.buffer.data(), env.buffer.size());
+        if constexpr (Debug)
+            *env.output << "=====================================" << std::endl;
         env.stack.top()->links--;
         env.stack.pop();
     }
-    else
+    else if (env.intrinsics.functions[index].name == Intrinsic::SNAPSHOT)
+    {
+        if (env.stop_at_snapshot)
+            throw snapshot::Point();
+    }
+    else if (env.intrinsics.functions[index].name == Intrinsic::INTERN)
+    {
+        runtime::Object *string = env.stack.top();
+        if (string->type != runtime::Type::STRING)
+            throw code::InvalidBytecodeException("Only strings can be interned");
+        runtime::Object *interned = string->interned ? string : env.strings.find(std::string_view(reinterpret_cast<const char *>(string->data), string->data_size));
+        // Growable strings may still change in place, so the table gets a copy of them
+        if (interned == nullptr)
+            interned = env.strings.add(string->growable ? env.allocator.create(runtime::Type::STRING, string->data, string->data_size) : string);
+        env.stack.top()->links--;
+        env.stack.pop();
+        interned->links++;
+        env.stack.push(interned);
+    }
+    else if (!arrays::call(env.intrinsics.functions[index].name, env) && !maps::call(env.intrinsics.functions[index].name, env))
     {
         throw code::InvalidBytecodeException("Unsupported intrinsic function");
     }
 }
 
-void vm::process(code::Reader &reader, Environment &env, std::size_t length, std::size_t local_count, bool debug_mode)
+template void proccess::call_intrinsic<false>(u16, Environment &);
+template void proccess::call_intrinsic<true>(u16, Environment &);
+
+void debug::trace(Environment &env, std::size_t offset, byte command, u32 operand)
+{
+    debug::TraceRecord record{offset, command, operand, env.stack.size(), runtime::Type::VOID, 0};
+    if (!env.stack.empty())
+    {
+        runtime::Object *top = env.stack.top();
+        record.top_type = top->type;
+        if (top->type == runtime::Type::I32)
+            record.top_value = static_cast<int>(*top);
+        else if (top->type == runtime::Type::USIZE)
+            record.top_value = static_cast<u32>(*top);
+        else
+            record.top_value = static_cast<std::int64_t>(top->data_size);
+    }
+    env.tracer->record(record);
+}
+
+// A string no one else links to, apart from the variable about to be overwritten with the result,
+// can take the right operand in place. Appending doubles its buffer, so building a string is linear
+static runtime::Object *concatenate(Environment &env, runtime::Object *left, runtime::Object *right, const runtime::Object *overwritten)
+{
+    bool in_place = left->growable && (left->links == 0 || (left->links == 1 && left == overwritten));
+    if (in_place && right->type == runtime::Type::STRING && right != left)
+    {
+        left->append(right->data, right->data_size);
+        return left;
+    }
+    env.buffer.clear();
+    if (!in_place)
+        left->format(env.buffer);
+    right->format(env.buffer);
+    if (in_place)
+    {
+        left->append(reinterpret_cast<const byte *>(env.buffer.data()), env.buffer.size());
+        return left;
+    }
+    return env.allocator.create(runtime::Type::STRING, reinterpret_cast<const byte *>(env.buffer.data()), env.buffer.size(), true);
+}
+
+static void arithmetic(Environment &env, const char *operation, std::function<int(int &&, int &&)> int_func, std::function<u32(u32 &&, u32 &&)> u32_func)
+{
+    runtime::Object *overwritten = env.overwritten;
+    env.overwritten = nullptr;
+    runtime::Object *right = env.stack.top();
+    pop_object(env);
+    runtime::Object *left = env.stack.top();
+    pop_object(env);
+    runtime::Object *obj;
+    switch (std::max(left->type, right->type))
+    {
+    case runtime::Type::I32:
+    {
+        int result = int_func(static_cast<int>(*left), static_cast<int>(*right));
+        obj = env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), sizeof(int));
+        break;
+    }
+    case runtime::Type::USIZE:
+    {
+        u32 result = u32_func(static_cast<u32>(*left), static_cast<u32>(*right));
+        obj = env.allocator.create(runtime::Type::USIZE, reinterpret_cast<byte *>(&result), sizeof(u32));
+        break;
+    }
+    case runtime::Type::STRING:
+    {
+        obj = concatenate(env, left, right, overwritten);
+        break;
+    }
+    default:
+        throw code::InvalidBytecodeException("Invalid type for " + std::string(operation));
+    }
+    push_object(env, obj);
+}
+
+static void compare(Environment &env, const char *operation, std::function<bool(int &&, int &&)> int_func, std::function<bool(u32 &&, u32 &&)> u32_func)
+{
+    runtime::Object *right = env.stack.top();
+    pop_object(env);
+    runtime::Object *left = env.stack.top();
+    pop_object(env);
+    int result = 0;
+    switch (std::max(left->type, right->type))
+    {
+    case runtime::Type::I32:
+        result = int_func(static_cast<int>(*left), static_cast<int>(*right)) ? 1 : 0;
+        break;
+    case runtime::Type::USIZE:
+        result = u32_func(static_cast<u32>(*left), static_cast<u32>(*right)) ? 1 : 0;
+        break;
+    case runtime::Type::STRING:
+        if (left->type != right->type)
+            throw code::InvalidBytecodeException("Invalid type for " + std::string(operation));
+        // The order of the strings is compared against zero with the operation itself
+        result = int_func(left->compare(*right), 0) ? 1 : 0;
+        break;
+    default:
+        throw code::InvalidBytecodeException("Invalid type for " + std::string(operation));
+    }
+    push_object(env, env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), sizeof(int)));
+}
+
+static void logical(Environment &env, const char *, std::function<bool(bool &&, bool &&)> func)
+{
+    runtime::Object *right = env.stack.top();
+    pop_object(env);
+    runtime::Object *left = env.stack.top();
+    pop_object(env);
+    int result = func(static_cast<bool>(*left), static_cast<bool>(*right)) ? 1 : 0;
+    push_object(env, env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), 4));
+}
+
+// Compiled functions get the operations of the interpreter as callbacks
+static void call_compiled(void *compiled, code::Reader &reader, Environment &env)
+{
+    reinterpret_cast<proccess::jit_function *>(compiled)(
+        reader, env,
+        [&env](runtime::Object *obj)
+        { push_object(env, obj); },
+        [&env]()
+        { pop_object(env); },
+        std::bind_front(arithmetic, std::ref(env)),
+        std::bind_front(compare, std::ref(env)),
+        std::bind_front(logical, std::ref(env)));
+}
+
+// Object in the variable that the instruction at the reader position stores into, if it is a store
+static runtime::Object *store_target(code::Reader &reader, Environment &env, std::vector<runtime::Link> &local_variables)
+{
+    std::size_t offset = reader.get_offset();
+    byte command = reader.read_byte();
+    u16 index = reader.read_16();
+    reader.set_offset(offset);
+    if (command == Command::STORE_LOCAL)
+        return local_variables[index].object;
+    if (command == Command::STORE_GLOBAL)
+        return env.global.variables[index].object;
+    return nullptr;
+}
+
+template <bool Debug>
+static void execute(code::Reader &reader, Environment &env, std::size_t length, std::size_t local_count)
 {
     auto push = [&env](runtime::Object *obj)
     {
-        obj->links++;
-        env.stack.push(obj);
+        push_object(env, obj);
     };
     auto pop = [&env]()
     {
-        env.stack.top()->links--;
-        env.stack.pop();
+        pop_object(env);
     };
-    auto push_indexed = [&reader, &push, debug_mode](const char *suffix, std::function<runtime::Object *(u16)> getter)
+    auto push_indexed = [&reader, &push](std::function<runtime::Object *(u16)> getter)
     {
         u16 index = reader.read_16();
-        if (debug_mode)
-            std::cout << "PUSH_" << suffix << " from index " << index << std::endl;
         push(getter(index));
+        return index;
     };
-    auto store_indexed = [&reader, &env, &pop, debug_mode](const char *suffix, std::function<runtime::Link *(u16)> getter)
+    auto store_indexed = [&reader, &env, &pop](std::function<runtime::Link *(u16)> getter)
     {
         u16 index = reader.read_16();
-        if (debug_mode)
-            std::cout << "STORE_" << suffix << " to index " << index << std::endl;
         *getter(index) = env.stack.top();
         pop();
+        return index;
     };
-    auto arithmetic_operation = [&env, &pop, &push, debug_mode](const char *operation, std::function<int(int &&, int &&)> int_func, std::function<u32(u32 &&, u32 &&)> u32_func, std::function<std::string(std::string &&, std::string &&)> str_func)
-    {
-        runtime::Object *right = env.stack.top();
-        pop();
-        runtime::Object *left = env.stack.top();
-        pop();
-        if (debug_mode)
-            std::cout << operation << " of " << static_cast<std::string>(*left) << " " << static_cast<std::string>(*right) << std::endl;
-        runtime::Object *obj;
-        switch (std::max(left->type, right->type))
-        {
-        case runtime::Type::I32:
-        {
-            int result = int_func(static_cast<int>(*left), static_cast<int>(*right));
-            obj = env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), sizeof(int));
-            break;
-        }
-        case runtime::Type::USIZE:
-        {
-            u32 result = u32_func(static_cast<u32>(*left), static_cast<u32>(*right));
-            obj = env.allocator.create(runtime::Type::USIZE, reinterpret_cast<byte *>(&result), sizeof(u32));
-            break;
-        }
-        case runtime::Type::STRING:
-        {
-            std::string result = str_func(static_cast<std::string>(*left), static_cast<std::string>(*right));
-            obj = env.allocator.create(runtime::Type::STRING, reinterpret_cast<const byte *>(result.c_str()), result.size());
-            break;
-        }
-        default:
-            throw code::InvalidBytecodeException("Invalid type for " + std::string(operation));
-        }
-        push(obj);
-    };
-    auto compare_operation = [&env, &pop, &push, debug_mode](const char *operation, std::function<bool(int &&, int &&)> int_func, std::function<bool(u32 &&, u32 &&)> u32_func)
-    {
-        runtime::Object *right = env.stack.top();
-        pop();
-        runtime::Object *left = env.stack.top();
-        pop();
-        if (debug_mode)
-            std::cout << operation << " of " << static_cast<std::string>(*left) << " " << static_cast<std::string>(*right) << std::endl;
-        int result = 0;
-        switch (std::max(left->type, right->type))
-        {
-        case runtime::Type::I32:
-            result = int_func(static_cast<int>(*left), static_cast<int>(*right)) ? 1 : 0;
-            break;
-        case runtime::Type::USIZE:
-            result = u32_func(static_cast<u32>(*left), static_cast<u32>(*right)) ? 1 : 0;
-            break;
-        default:
-            throw code::InvalidBytecodeException("Invalid type for " + std::string(operation));
-        }
-        push(env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), sizeof(int)));
-    };
-    auto logical_operation = [&env, &pop, &push, debug_mode](const char *operation, std::function<bool(bool &&, bool &&)> func)
-    {
-        runtime::Object *right = env.stack.top();
-        pop();
-        runtime::Object *left = env.stack.top();
-        pop();
-        if (debug_mode)
-            std::cout << operation << " of " << static_cast<std::string>(*left) << " " << static_cast<std::string>(*right) << std::endl;
-        int result = func(static_cast<bool>(*left), static_cast<bool>(*right)) ? 1 : 0;
-        push(env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), 4));
-    };
-    auto jump_if = [&reader, &env, &pop, debug_mode](bool condition)
+    auto jump_if = [&reader, &env, &pop](bool condition)
     {
         int length = static_cast<std::int16_t>(reader.read_16());
         runtime::Object *condition_obj = env.stack.top();
         pop();
-        if (debug_mode)
-            std::cout << "JUMP_IF_" << (condition ? "TRUE" : "FALSE") << " to " << length << std::endl;
         if (condition == static_cast<bool>(*condition_obj))
             reader.set_offset(reader.get_offset() + length);
+        return static_cast<u32>(length);
     };
 
     std::size_t start = reader.get_offset();
     std::vector<runtime::Link> local_variables(local_count);
+    stats::Counters &counters = stats::local();
     while (reader.get_offset() - start < length)
     {
+        std::size_t offset = reader.get_offset();
         byte command = reader.read_byte();
+        u32 operand = 0;
+        stats::add(counters.instructions);
+        env.allocator.site = static_cast<u32>(offset);
         switch (command)
         {
         case Command::PUSH_CONST:
         {
-            push_indexed("CONST", [&env](u16 index)
-                         { return env.constant_pool.data[index]; });
+            operand = push_indexed([&env](u16 index)
+                                   { return env.constant_pool.data[index]; });
             break;
         }
         case Command::PUSH_LOCAL:
         {
-            push_indexed("LOCAL", [&local_variables](u16 index)
-                         { return local_variables[index].object; });
+            operand = push_indexed([&local_variables](u16 index)
+                                   { return local_variables[index].object; });
             break;
         }
         case Command::PUSH_GLOBAL:
         {
-            push_indexed("GLOBAL", [&env](u16 index)
-                         { return env.global.variables[index].object; });
+            operand = push_indexed([&env](u16 index)
+                                   { return env.global.variables[index].object; });
             break;
         }
         case Command::STORE_LOCAL:
         {
-            store_indexed("LOCAL", [&local_variables](u16 index)
-                          { return &local_variables[index]; });
+            operand = store_indexed([&local_variables](u16 index)
+                                    { return &local_variables[index]; });
             break;
         }
         case Command::STORE_GLOBAL:
         {
-            store_indexed("GLOBAL", [&env](u16 index)
-                          { return &env.global.variables[index]; });
+            operand = store_indexed([&env](u16 index)
+                                    { return &env.global.variables[index]; });
             break;
         }
         case Command::POP:
         {
-            if (debug_mode)
-                std::cout << "POP " << std::endl;
             pop();
             break;
         }
         case Command::DUP:
         {
-            if (debug_mode)
-                std::cout << "DUP " << std::endl;
             push(env.stack.top());
             break;
         }
@@ -214,15 +320,13 @@ void vm::process(code::Reader &reader, Environment &env, std::size_t length, std
         case Command::DIV:
         case Command::MOD:
         {
-            arithmetic_operation(
-                command == Command::ADD ? "ADD" : command == Command::SUB ? "SUB"
-                                              : command == Command::MUL   ? "MUL"
-                                              : command == Command::DIV   ? "DIV"
-                                                                          : "MOD",
+            if (command == Command::ADD && reader.get_offset() - start + 3 <= length)
+                env.overwritten = store_target(reader, env, local_variables);
+            arithmetic(
+                env,
+                code::command_name(command),
                 proccess::get_arithmetic_function<int>(command),
-                proccess::get_arithmetic_function<u32>(command),
-                [](std::string &&a, std::string &&b)
-                { return a + b; });
+                proccess::get_arithmetic_function<u32>(command));
             break;
         }
 
@@ -233,12 +337,9 @@ void vm::process(code::Reader &reader, Environment &env, std::size_t length, std
         case Command::GT:
         case Command::GTE:
         {
-            compare_operation(
-                command == Command::EQ ? "EQ" : command == Command::NEQ ? "NEQ"
-                                            : command == Command::LT    ? "LT"
-                                            : command == Command::LE    ? "LE"
-                                            : command == Command::GT    ? "GT"
-                                                                        : "GTE",
+            compare(
+                env,
+                code::command_name(command),
                 proccess::get_comparison_function<int>(command),
                 proccess::get_comparison_function<u32>(command));
             break;
@@ -246,9 +347,9 @@ void vm::process(code::Reader &reader, Environment &env, std::size_t length, std
         case Command::AND:
         case Command::OR:
         {
-            logical_operation(
-                command == Command::AND ? "AND"
-                                        : "OR",
+            logical(
+                env,
+                code::command_name(command),
                 proccess::get_logical_function(command));
             break;
         }
@@ -256,8 +357,6 @@ void vm::process(code::Reader &reader, Environment &env, std::size_t length, std
         {
             runtime::Object *obj = env.stack.top();
             pop();
-            if (debug_mode)
-                std::cout << "Not of " << (int)*obj << std::endl;
             int result = !static_cast<bool>(*obj);
             push(env.allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&result), 4));
             break;
@@ -266,131 +365,309 @@ void vm::process(code::Reader &reader, Environment &env, std::size_t length, std
         case Command::JMP:
         {
             int length = static_cast<std::int16_t>(reader.read_16());
-            if (debug_mode)
-                std::cout << "JMP to " << length << std::endl;
+            operand = static_cast<u32>(length);
             reader.set_offset(reader.get_offset() + length);
             break;
         }
         case Command::JMP_IF_FALSE:
         case Command::JMP_IF_TRUE:
         {
-            jump_if(command == Command::JMP_IF_TRUE);
+            operand = jump_if(command == Command::JMP_IF_TRUE);
             break;
         }
         case Command::CALL:
         {
             u16 index = reader.read_16();
             code::Function &func = env.functions.functions[index];
-            if (debug_mode)
-                std::cout << "CALL of " << index << std::endl;
+            operand = index;
+            if constexpr (Debug)
+                debug::trace(env, offset, command, operand);
+            stats::add(counters.calls);
             std::size_t current_addr = reader.get_offset();
-            if (func.calls++ > 100)
+            if (func.compiled_code(Debug).load(std::memory_order_relaxed) != nullptr || env.calls[index]++ > env.jit_threshold)
             {
-                if (func.compiled == nullptr)
-                {
-                    reader.set_offset(func.offset);
-                    jit::compile_func(reader, index, func, debug_mode);
-                }
-
-                reinterpret_cast<proccess::jit_function *>(func.compiled)(reader, env, push, pop, arithmetic_operation, compare_operation, logical_operation, debug_mode);
+                void *compiled = jit::compiled(env, reader, index, Debug);
+                profile::CallGuard guard(index, nullptr, func.offset, offset);
+                call_compiled(compiled, reader, env);
             }
             else
             {
                 reader.set_offset(func.offset);
-                process(reader, env, func.length, func.local_count + func.arg_count, debug_mode);
+                profile::CallGuard guard(index, &reader, func.offset, offset);
+                execute<Debug>(reader, env, func.length, func.local_count + func.arg_count);
             }
             reader.set_offset(current_addr);
-            break;
+            continue;
         }
         case Command::RET:
         {
-            if (debug_mode)
-                std::cout << "RET" << std::endl;
+            if constexpr (Debug)
+                debug::trace(env, offset, command, operand);
             return;
         }
         case Command::HALT:
         {
-            if (debug_mode)
-                std::cout << "HALT " << std::endl;
+            if constexpr (Debug)
+                debug::trace(env, offset, command, operand);
             throw runtime::HaltException("HALT command found in bytecode!");
         }
 
         case Command::NEW_ARRAY:
         {
             u32 size = reader.read_32();
-            if (debug_mode)
-                std::cout << "NEW_ARRAY of " << size << " elements" << std::endl;
-            reader.skip(1U);
-            push(env.allocator.create(runtime::Type::ARRAY, nullptr, size));
+            operand = size;
+            runtime::Type element = static_cast<runtime::Type>(reader.read_byte());
+            push(env.allocator.create_array(size, element));
             break;
         }
         case Command::GET_ARRAY:
         {
-            runtime::Object *index = env.stack.top();
-            pop();
-            runtime::Object *array = env.stack.top();
-            pop();
-            if (debug_mode)
-                std::cout << "GET_ARRAY in " << (int)*index << std::endl;
-            push(reinterpret_cast<runtime::Link *>(array->data)[static_cast<u32>(*index)].object);
+            proccess::get_array(env);
             break;
         }
         case Command::SET_ARRAY:
         {
-            runtime::Object *index = env.stack.top();
-            pop();
-            runtime::Object *value = env.stack.top();
-            pop();
-            runtime::Object *array = env.stack.top();
-            pop();
-            if (debug_mode)
-                std::cout << "SET_ARRAY in " << static_cast<u32>(*index) << " with " << static_cast<int>(*value) << std::endl;
-            reinterpret_cast<runtime::Link *>(array->data)[static_cast<u32>(*index)] = value;
+            proccess::set_array(env);
             break;
         }
         case Command::INIT_ARRAY:
         {
             u16 size = reader.read_16();
-            if (debug_mode)
-                std::cout << "INIT_ARRAY of size " << size << std::endl;
-            runtime::Object **objects = new runtime::Object *[size];
-            for (u16 i = 0; i < size; ++i)
-            {
-                objects[i] = env.stack.top();
-                pop();
-            }
-            runtime::Object *array = env.stack.top();
-            pop();
-            for (u16 i = 0; i < size; ++i)
-            {
-                reinterpret_cast<runtime::Link *>(array->data)[i] = objects[i];
-            }
-            delete[] objects;
-            push(array);
+            operand = size;
+            proccess::init_array(env, size);
             break;
         }
         case Command::INTRINSIC_CALL:
         {
             u16 index = reader.read_16();
-            if (debug_mode)
-                std::cout << "INTRINSIC_CALL of " << index << std::endl;
-            proccess::call_intrinsic(index, env, debug_mode);
-            break;
+            operand = index;
+            if constexpr (Debug)
+                debug::trace(env, offset, command, operand);
+            proccess::call_intrinsic<Debug>(index, env);
+            continue;
+        }
         }
+        if constexpr (Debug)
+            debug::trace(env, offset, command, operand);
+    }
+}
+
+void vm::process(code::Reader &reader, Environment &env, std::size_t length, std::size_t local_count, bool debug_mode)
+{
+    if (!debug_mode)
+    {
+        execute<false>(reader, env, length, local_count);
+    }
+    else if (env.tracer != nullptr)
+    {
+        execute<true>(reader, env, length, local_count);
+    }
+    else
+    {
+        debug::Tracer tracer(*env.output);
+        env.tracer = &tracer;
+        try
+        {
+            execute<true>(reader, env, length, local_count);
         }
-        if (debug_mode)
+        catch (...)
         {
-            std::cout << "Stack size: " << env.stack.size() << std::endl;
-            std::cout << "Address " << std::hex << reader.get_offset() << std::endl;
+            env.tracer = nullptr;
+            throw;
         }
+        env.tracer = nullptr;
+    }
+}
+
+void vm::call(Environment &env, code::Reader &reader, u16 index, bool debug_mode)
+{
+    code::Function &func = env.functions.functions[index];
+    // Debug builds of compiled code trace into env.tracer, which only process sets up
+    bool hot = func.compiled_code(debug_mode).load(std::memory_order_relaxed) != nullptr || env.calls[index]++ > env.jit_threshold;
+    if (hot && (!debug_mode || env.tracer != nullptr))
+    {
+        void *compiled = jit::compiled(env, reader, index, debug_mode);
+        profile::CallGuard guard(index, nullptr, func.offset, 0);
+        call_compiled(compiled, reader, env);
+    }
+    else
+    {
+        reader.set_offset(func.offset);
+        profile::CallGuard guard(index, &reader, func.offset, 0);
+        process(reader, env, func.length, func.local_count + func.arg_count, debug_mode);
     }
 }
 
 void vm::process(const fs::path &file, bool debug_mode)
 {
-    code::Reader reader(file);
-    memory::Allocator allocator;
-    Environment env(allocator, parse_header(reader), reader.read_constants(), reader.read_globals(), reader.read_functions(), reader.read_intrinsics());
-    u32 length = reader.read_32();
-    process(reader, env, length, 0, debug_mode);
-}
\ No newline at end of file
+    Options options;
+    options.debug_mode = debug_mode;
+    process(file, options);
+}
+
+// Leaves the reader at the length of the main body
+static std::shared_ptr<Image> read_image(code::Reader &reader, std::shared_ptr<const std::vector<byte>> bytes)
+{
+    phases::Scope scope(phases::LOAD);
+    code::Header header = parse_header(reader);
+    code::ConstantPool constants = reader.read_constants();
+    u16 global_count = reader.read_globals().size;
+    code::FunctionTable functions = reader.read_functions();
+    code::IntrinsicTable intrinsics = reader.read_intrinsics();
+    std::size_t body_offset = reader.get_offset();
+    u32 body_length = reader.read_32();
+    reader.set_offset(body_offset);
+    return std::make_shared<Image>(std::move(bytes), header, std::move(constants), global_count, std::move(functions),
+                                   std::move(intrinsics), body_offset + 4, body_length);
+}
+
+vm::Environment vm::load(code::Reader &reader, memory::Allocator &allocator)
+{
+    return Environment(read_image(reader, nullptr), std::move(allocator));
+}
+
+std::shared_ptr<Image> vm::load_image(const fs::path &file)
+{
+    std::ifstream input(file, std::ios::binary);
+    if (!input.is_open())
+        throw std::runtime_error("File opening failed");
+    return load_image(std::vector<byte>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()));
+}
+
+std::shared_ptr<Image> vm::load_image(std::vector<byte> bytes)
+{
+    auto shared = std::make_shared<const std::vector<byte>>(std::move(bytes));
+    code::Reader reader(shared);
+    return read_image(reader, shared);
+}
+
+std::uint64_t vm::content_hash(const std::vector<byte> &bytes)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (byte value : bytes)
+    {
+        hash ^= value;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void vm::run(Environment &env, bool debug_mode, std::size_t resume_offset)
+{
+    std::size_t body_end = env.image->body_offset + env.image->body_length;
+    std::size_t start = resume_offset == 0 ? env.image->body_offset : resume_offset;
+    if (start < env.image->body_offset || start > body_end)
+        throw std::out_of_range("Resume offset is outside of the main body");
+    code::Reader reader = env.image->reader();
+    reader.set_offset(start);
+    if (env.image->compiled_main != nullptr && start == env.image->body_offset && !debug_mode)
+    {
+        profile::CallGuard guard(profile::MAIN_BODY, nullptr, env.image->body_offset, 0);
+        call_compiled(env.image->compiled_main, reader, env);
+        return;
+    }
+    profile::CallGuard guard(profile::MAIN_BODY, &reader, env.image->body_offset, 0);
+    process(reader, env, body_end - start, 0, debug_mode);
+}
+
+static void finish_run(const Options &options, const Environment &env)
+{
+    if (!options.profile_output.empty())
+    {
+        profile::stop();
+        std::ofstream output(options.profile_output, std::ios::trunc);
+        profile::write_collapsed(output, env.functions);
+    }
+    perf::close();
+    if (!options.stats_output.empty())
+    {
+        stats::stop_dump_on_signal();
+        stats::write_json(options.stats_output);
+    }
+    if (!options.heap_profile.empty())
+    {
+        std::ofstream output(options.heap_profile, std::ios::trunc);
+        heap::write_snapshot(output, env);
+    }
+    if (options.phase_counters)
+        phases::write_report(std::cerr);
+}
+
+// Every isolate runs on a thread of its own, the first failure is rethrown once all of them finished
+static void run_isolates(std::vector<Environment> &isolates, bool debug_mode, std::size_t resume_offset)
+{
+    std::vector<std::exception_ptr> failures(isolates.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < isolates.size(); ++i)
+    {
+        threads.emplace_back([&isolates, &failures, debug_mode, resume_offset, i]
+                             {
+                                 try
+                                 {
+                                     run(isolates[i], debug_mode, resume_offset);
+                                 }
+                                 catch (...)
+                                 {
+                                     failures[i] = std::current_exception();
+                                 } });
+    }
+    try
+    {
+        phases::Scope scope(phases::INTERPRET);
+        run(isolates[0], debug_mode, resume_offset);
+    }
+    catch (...)
+    {
+        failures[0] = std::current_exception();
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (const std::exception_ptr &failure : failures)
+    {
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+}
+
+void vm::process(const fs::path &file, const Options &options)
+{
+    if (options.phase_counters)
+        phases::enable();
+    std::shared_ptr<Image> image = load_image(file);
+    // Opened first, so the functions of an ahead-of-time compiled library are described too
+    if (options.perf_map)
+        perf::open_map();
+    if (options.jitdump)
+        perf::open_jitdump();
+    if (!options.native_library.empty())
+        jit::load_program(*image, options.native_library, std::cerr);
+    std::vector<Environment> isolates;
+    isolates.reserve(std::max(options.isolates, 1U));
+    for (unsigned i = 0; i < std::max(options.isolates, 1U); ++i)
+        isolates.emplace_back(image);
+    if (!options.profile_output.empty())
+        profile::start(options.profile_frequency);
+    if (!options.stats_output.empty())
+        stats::dump_on_signal(options.stats_output);
+    for (Environment &env : isolates)
+        env.allocator.track_sites(!options.heap_profile.empty());
+    try
+    {
+        std::size_t resume_offset = 0;
+        for (Environment &env : isolates)
+        {
+            if (!options.snapshot_input.empty())
+                resume_offset = snapshot::restore(options.snapshot_input, env);
+        }
+        if (!options.snapshot_output.empty())
+            snapshot::create(options.snapshot_output, isolates[0], options.debug_mode);
+        else
+            run_isolates(isolates, options.debug_mode, resume_offset);
+    }
+    catch (...)
+    {
+        finish_run(options, isolates[0]);
+        throw;
+    }
+    finish_run(options, isolates[0]);
+}
@@ -0,0 +1,194 @@
+#include "vm.hpp"
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <sys/time.h>
+
+using namespace vm;
+
+namespace
+{
+    constexpr std::size_t MAX_DEPTH = 128;
+    constexpr std::size_t SAMPLE_SLOTS = 1024;
+
+    struct Frame
+    {
+        u16 function;
+        const code::Reader *reader;
+        std::size_t offset;
+    };
+
+    // Only the owning thread writes it, the SIGPROF handler reads it on the same thread
+    struct ShadowStack
+    {
+        Frame frames[MAX_DEPTH];
+        volatile std::size_t depth = 0;
+    };
+
+    struct Sample
+    {
+        std::atomic<bool> ready{false};
+        std::size_t depth;
+        std::uint64_t frames[MAX_DEPTH];
+    };
+
+    thread_local ShadowStack shadow_stack;
+
+    Sample *samples = nullptr;
+    std::atomic<std::size_t> samples_head{0};
+    std::atomic<std::size_t> samples_tail{0};
+    std::atomic<std::size_t> dropped_samples{0};
+
+    std::atomic<bool> collecting{false};
+    std::thread collector;
+    std::map<std::vector<std::uint64_t>, std::size_t> stacks;
+    std::mutex stacks_mutex;
+    struct sigaction previous_action;
+
+    std::uint64_t pack(u16 function, std::size_t offset)
+    {
+        return (static_cast<std::uint64_t>(function) << 48) | (offset & 0xFFFFFFFFFFFFULL);
+    }
+
+    void take_sample(int)
+    {
+        std::size_t depth = shadow_stack.depth;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        if (depth == 0)
+            return;
+
+        std::size_t slot = samples_head.load(std::memory_order_relaxed);
+        do
+        {
+            if (slot - samples_tail.load(std::memory_order_acquire) >= SAMPLE_SLOTS)
+            {
+                dropped_samples.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } while (!samples_head.compare_exchange_weak(slot, slot + 1, std::memory_order_acq_rel));
+
+        Sample &sample = samples[slot % SAMPLE_SLOTS];
+        sample.depth = std::min(depth, MAX_DEPTH);
+        for (std::size_t i = 0; i < sample.depth; ++i)
+        {
+            const Frame &frame = shadow_stack.frames[i];
+            bool leaf = i + 1 == depth;
+            std::size_t offset = leaf && frame.reader != nullptr ? frame.reader->get_offset() : frame.offset;
+            sample.frames[i] = pack(frame.function, offset);
+        }
+        sample.ready.store(true, std::memory_order_release);
+    }
+
+    void drain_samples()
+    {
+        std::lock_guard<std::mutex> lock(stacks_mutex);
+        std::size_t tail = samples_tail.load(std::memory_order_relaxed);
+        while (samples[tail % SAMPLE_SLOTS].ready.load(std::memory_order_acquire))
+        {
+            Sample &sample = samples[tail % SAMPLE_SLOTS];
+            ++stacks[std::vector<std::uint64_t>(sample.frames, sample.frames + sample.depth)];
+            sample.ready.store(false, std::memory_order_relaxed);
+            samples_tail.store(++tail, std::memory_order_release);
+        }
+    }
+
+    void collect_samples()
+    {
+        while (collecting.load(std::memory_order_acquire))
+        {
+            drain_samples();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        drain_samples();
+    }
+
+    void set_timer(unsigned frequency)
+    {
+        itimerval timer{};
+        if (frequency > 0)
+        {
+            timer.it_interval.tv_sec = 0;
+            timer.it_interval.tv_usec = std::max(1000000 / frequency, 1U);
+            timer.it_value = timer.it_interval;
+        }
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+}
+
+profile::CallGuard::CallGuard(u16 function, const code::Reader *reader, std::size_t entry, std::size_t call_site)
+{
+    std::size_t depth = shadow_stack.depth;
+    if (depth > 0 && depth <= MAX_DEPTH)
+        shadow_stack.frames[depth - 1].offset = call_site;
+    if (depth < MAX_DEPTH)
+        shadow_stack.frames[depth] = {function, reader, entry};
+    std::atomic_signal_fence(std::memory_order_release);
+    shadow_stack.depth = depth + 1;
+}
+
+profile::CallGuard::~CallGuard()
+{
+    shadow_stack.depth = shadow_stack.depth - 1;
+}
+
+void profile::start(unsigned frequency)
+{
+    if (collecting.exchange(true))
+        throw std::logic_error("Profiler is already running");
+
+    if (samples == nullptr)
+        samples = new Sample[SAMPLE_SLOTS];
+    stacks.clear();
+    dropped_samples.store(0);
+    collector = std::thread(collect_samples);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previous_action);
+    set_timer(frequency);
+}
+
+void profile::stop()
+{
+    if (!collecting.load())
+        return;
+
+    set_timer(0);
+    sigaction(SIGPROF, &previous_action, nullptr);
+    collecting.store(false, std::memory_order_release);
+    collector.join();
+}
+
+static void write_frame(std::ostream &output, std::uint64_t frame, const code::FunctionTable &functions)
+{
+    u16 function = static_cast<u16>(frame >> 48);
+    if (function == profile::MAIN_BODY)
+        output << "<main>";
+    else if (function < functions.size && !functions.functions[function].name.empty())
+        output << functions.functions[function].name;
+    else
+        output << "func_" << function;
+    output << "@0x" << std::hex << (frame & 0xFFFFFFFFFFFFULL) << std::dec;
+}
+
+void profile::write_collapsed(std::ostream &output, const code::FunctionTable &functions)
+{
+    std::lock_guard<std::mutex> lock(stacks_mutex);
+    for (const auto &[frames, count] : stacks)
+    {
+        for (std::size_t i = 0; i < frames.size(); ++i)
+        {
+            if (i > 0)
+                output << ';';
+            write_frame(output, frames[i], functions);
+        }
+        output << ' ' << count << '\n';
+    }
+    if (dropped_samples.load() > 0)
+        output << "<dropped> " << dropped_samples.load() << '\n';
+}
@@ -0,0 +1,279 @@
+#include "vm.hpp"
+#include <optional>
+#include <set>
+
+using namespace vm;
+using Command = vm::code::Command;
+
+namespace
+{
+    struct Instruction
+    {
+        std::size_t offset;
+        byte command;
+        // Index operand, or the absolute target of a jump
+        std::size_t operand = 0;
+    };
+
+    bool is_jump(byte command)
+    {
+        return command == Command::JMP || command == Command::JMP_IF_FALSE || command == Command::JMP_IF_TRUE;
+    }
+
+    std::vector<Instruction> decode(code::Reader &reader, std::size_t length)
+    {
+        std::vector<Instruction> code;
+        std::size_t start = reader.get_offset();
+        while (reader.get_offset() - start < length)
+        {
+            Instruction instruction{reader.get_offset(), reader.read_byte()};
+            switch (instruction.command)
+            {
+            case Command::JMP:
+            case Command::JMP_IF_FALSE:
+            case Command::JMP_IF_TRUE:
+            {
+                int jump = static_cast<std::int16_t>(reader.read_16());
+                instruction.operand = reader.get_offset() + jump;
+                break;
+            }
+            case Command::PUSH_CONST:
+            case Command::PUSH_LOCAL:
+            case Command::PUSH_GLOBAL:
+            case Command::STORE_LOCAL:
+            case Command::STORE_GLOBAL:
+            case Command::CALL:
+            case Command::INIT_ARRAY:
+            case Command::INTRINSIC_CALL:
+                instruction.operand = reader.read_16();
+                break;
+            case Command::NEW_ARRAY:
+                reader.skip(5U);
+                break;
+            }
+            code.push_back(instruction);
+        }
+        return code;
+    }
+
+    // Where a value on the stack came from: PUSH_LOCAL or PUSH_CONST with its index, 0 when unknown
+    struct Source
+    {
+        byte command = 0;
+        std::size_t index = 0;
+
+        bool is_local(std::size_t local) const
+        {
+            return command == Command::PUSH_LOCAL && index == local;
+        }
+    };
+
+    // The values on top of the real stack, as far as they are known. Values below a merge point or a call
+    // are forgotten, so this is always a suffix of the real stack
+    class Stack
+    {
+    public:
+        void push(Source source = {})
+        {
+            values.push_back(source);
+        }
+
+        void pop(std::size_t count = 1)
+        {
+            values.resize(values.size() - std::min(count, values.size()));
+        }
+
+        // Source of the value depth places below the top
+        Source peek(std::size_t depth) const
+        {
+            return depth < values.size() ? values[values.size() - 1 - depth] : Source{};
+        }
+
+        void clear()
+        {
+            values.clear();
+        }
+
+        void apply(const Instruction &instruction)
+        {
+            switch (instruction.command)
+            {
+            case Command::PUSH_CONST:
+            case Command::PUSH_LOCAL:
+                push({instruction.command, instruction.operand});
+                break;
+            case Command::PUSH_GLOBAL:
+            case Command::NEW_ARRAY:
+                push();
+                break;
+            case Command::DUP:
+                push(peek(0));
+                break;
+            case Command::STORE_LOCAL:
+            case Command::STORE_GLOBAL:
+            case Command::POP:
+            case Command::JMP_IF_FALSE:
+            case Command::JMP_IF_TRUE:
+                pop();
+                break;
+            case Command::NOT:
+                pop();
+                push();
+                break;
+            case Command::GET_ARRAY:
+                pop(2);
+                push();
+                break;
+            case Command::SET_ARRAY:
+                pop(3);
+                break;
+            case Command::INIT_ARRAY:
+                pop(instruction.operand);
+                break;
+            case Command::ADD:
+            case Command::SUB:
+            case Command::MUL:
+            case Command::DIV:
+            case Command::MOD:
+            case Command::EQ:
+            case Command::NEQ:
+            case Command::LT:
+            case Command::LE:
+            case Command::GT:
+            case Command::GTE:
+            case Command::AND:
+            case Command::OR:
+                pop(2);
+                push();
+                break;
+            default:
+                // Jumps, returns and calls, whose effect on the stack the bytecode does not tell
+                clear();
+                break;
+            }
+        }
+
+    private:
+        std::vector<Source> values;
+    };
+
+    bool is(const std::vector<Instruction> &code, std::size_t at, byte command)
+    {
+        return at < code.size() && code[at].command == command;
+    }
+
+    // The loop closed by the backward jump at latch, when it has the shape of a counted loop
+    std::optional<ranges::Loop> loop_at(const std::vector<Instruction> &code, std::size_t latch, std::map<std::size_t, std::size_t> &accesses, std::size_t id)
+    {
+        std::size_t header_offset = code[latch].operand, end = code[latch].offset;
+        std::size_t header = 0;
+        while (header < latch && code[header].offset != header_offset)
+            ++header;
+        if (header == latch)
+            return std::nullopt;
+
+        // Only innermost loops that are entered through their header: every path from the header to an
+        // instruction of the loop then only goes forward
+        std::set<std::size_t> targets;
+        for (std::size_t k = 0; k < code.size(); ++k)
+        {
+            if (!is_jump(code[k].command))
+                continue;
+            bool inside = k >= header && k <= latch;
+            if (inside && k != latch && code[k].operand <= code[k].offset)
+                return std::nullopt;
+            if (!inside && code[k].operand > header_offset && code[k].operand <= end)
+                return std::nullopt;
+            if (inside)
+                targets.insert(code[k].operand);
+        }
+
+        ranges::Loop loop{header_offset, end};
+        if (!is(code, header, Command::PUSH_LOCAL))
+            return std::nullopt;
+        loop.index = static_cast<u16>(code[header].operand);
+        std::size_t compare = header + 2;
+        loop.bound_command = code[header + 1].command;
+        loop.bound = static_cast<u16>(code[header + 1].operand);
+        if (is(code, header + 1, Command::PUSH_LOCAL) && is(code, header + 2, Command::INTRINSIC_CALL))
+        {
+            loop.bound_command = Command::INTRINSIC_CALL;
+            loop.array = loop.bound;
+            loop.bound = static_cast<u16>(code[header + 2].operand);
+            compare = header + 3;
+        }
+        else if (!is(code, header + 1, Command::PUSH_LOCAL) && !is(code, header + 1, Command::PUSH_CONST))
+        {
+            return std::nullopt;
+        }
+        if (!is(code, compare, Command::LT) || !is(code, compare + 1, Command::JMP_IF_FALSE) || code[compare + 1].operand <= end)
+            return std::nullopt;
+        bool length_bound = loop.bound_command == Command::INTRINSIC_CALL;
+
+        // Accesses to array[index] before anything in the loop stores into either variable
+        Stack stack;
+        std::set<std::size_t> stored;
+        std::vector<std::size_t> safe;
+        bool array_known = length_bound;
+        bool step_known = false;
+        for (std::size_t k = compare + 2; k < latch; ++k)
+        {
+            const Instruction &instruction = code[k];
+            if (targets.count(instruction.offset))
+                stack.clear();
+            if (instruction.command == Command::GET_ARRAY || instruction.command == Command::SET_ARRAY)
+            {
+                Source index = stack.peek(0);
+                Source array = stack.peek(instruction.command == Command::GET_ARRAY ? 1 : 2);
+                if (!array_known && array.command == Command::PUSH_LOCAL)
+                {
+                    loop.array = static_cast<u16>(array.index);
+                    array_known = true;
+                }
+                if (index.is_local(loop.index) && array_known && array.is_local(loop.array) && !stored.count(loop.index) && !stored.count(loop.array))
+                    safe.push_back(instruction.offset);
+            }
+            if (instruction.command == Command::STORE_LOCAL)
+            {
+                stored.insert(instruction.operand);
+                // A length bound is compared with the index again on every iteration. Otherwise the
+                // only store into the index must add the same constant to it
+                if (!length_bound && instruction.operand == loop.index)
+                {
+                    bool increment = k >= 3 && code[k - 3].command == Command::PUSH_LOCAL && code[k - 3].operand == loop.index &&
+                                     code[k - 2].command == Command::PUSH_CONST && code[k - 1].command == Command::ADD &&
+                                     !targets.count(code[k - 2].offset) && !targets.count(code[k - 1].offset) && !targets.count(instruction.offset);
+                    if (!increment || (step_known && loop.step != code[k - 2].operand))
+                        return std::nullopt;
+                    loop.step = static_cast<u16>(code[k - 2].operand);
+                    step_known = true;
+                }
+            }
+            stack.apply(instruction);
+        }
+        if (safe.empty())
+            return std::nullopt;
+        // The hoisted check holds for the whole loop only when the array and the bound never change in it
+        if (!length_bound && (!step_known || stored.count(loop.array) ||
+                              (loop.bound_command == Command::PUSH_LOCAL && stored.count(loop.bound))))
+            return std::nullopt;
+        for (std::size_t offset : safe)
+            accesses[offset] = id;
+        return loop;
+    }
+}
+
+ranges::Analysis ranges::analyze(code::Reader &reader, std::size_t length)
+{
+    std::vector<Instruction> code = decode(reader, length);
+    Analysis analysis;
+    for (std::size_t k = 0; k < code.size(); ++k)
+    {
+        if (code[k].command != Command::JMP || code[k].operand > code[k].offset)
+            continue;
+        std::optional<Loop> loop = loop_at(code, k, analysis.accesses, analysis.loops.size());
+        if (loop)
+            analysis.loops.push_back(*loop);
+    }
+    return analysis;
+}
@@ -15,8 +15,14 @@ Reader::Reader(const fs::path &path)
     }
 }
 
+Reader::Reader(std::shared_ptr<const std::vector<byte>> image)
+    : _image(std::move(image)), _buffer(const_cast<byte *>(_image->data())), _capacity(_image->size()), _limit(_image->size()), _pos(0), _absolute_pos(0)
+{
+}
+
 Reader::Reader(Reader &&other)
     : _input(std::move(other._input)),
+      _image(std::move(other._image)),
       _buffer(other._buffer),
       _capacity(other._capacity),
       _limit(other._limit),
@@ -34,7 +40,9 @@ Reader &Reader::operator=(Reader &&other)
     if (this != &other)
     {
         _input = std::move(other._input);
-        delete[] _buffer;
+        if (!_image)
+            delete[] _buffer;
+        _image = std::move(other._image);
         _buffer = other._buffer;
         _capacity = other._capacity;
         _limit = other._limit;
@@ -91,6 +99,8 @@ static vm::runtime::Type to_type(byte id)
         return vm::runtime::Type::STRING;
     case 0x04:
         return vm::runtime::Type::ARRAY;
+    case 0x05:
+        return vm::runtime::Type::MAP;
     default:
         throw std::invalid_argument("Unknown type byte" + std::to_string(id));
     }
@@ -154,7 +164,8 @@ FunctionTable vm::code::Reader::read_functions()
     for (u16 i = 0; i < size; ++i)
     {
         byte name_length = read_byte();
-        skip(name_length);
+        functions[i].name.resize(name_length);
+        read_bytes(reinterpret_cast<byte *>(functions[i].name.data()), name_length);
         functions[i].arg_count = read_byte();
         functions[i].return_type = to_type(read_byte());
         functions[i].local_count = read_16();
@@ -202,7 +213,7 @@ void Reader::close()
 
 Reader::~Reader()
 {
-    if (_buffer)
+    if (_buffer && !_image)
     {
         delete[] _buffer;
     }
@@ -211,7 +222,7 @@ Reader::~Reader()
 
 void Reader::refill_buffer()
 {
-    if (_pos < _limit)
+    if (_pos < _limit || _image)
     {
         return;
     }
@@ -245,6 +256,11 @@ std::size_t vm::code::Reader::get_offset() const
 
 void vm::code::Reader::set_offset(std::size_t pos)
 {
+    if (_image)
+    {
+        _pos = pos;
+        return;
+    }
     _input.clear();
     _input.seekg(pos, std::ios_base::beg);
     _pos = _limit;
@@ -1,27 +1,192 @@
 #include "vm.hpp"
 #include <iostream>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <utility>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace vm::runtime;
 
-Object::Object(Type type, const byte *data, std::size_t data_size)
-    : type(type), data(nullptr), data_size(data_size), links(0)
+static std::size_t growable_capacity(std::size_t size)
+{
+    return std::bit_ceil(std::max<std::size_t>(size, 16));
+}
+
+byte *vm::runtime::allocate_elements(std::size_t bytes)
+{
+    if (bytes < LARGE_ARRAY_BYTES)
+        return new byte[bytes]();
+    // Untouched pages of the mapping read as zeroes and are not backed by memory until written
+    void *mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+        throw std::bad_alloc();
+    return static_cast<byte *>(mapping);
+}
+
+void vm::runtime::free_elements(byte *elements, std::size_t bytes)
+{
+    if (bytes < LARGE_ARRAY_BYTES)
+        delete[] elements;
+    else
+        munmap(elements, bytes);
+}
+
+Object::Object(Type type, const byte *data, std::size_t data_size, bool growable)
+    : type(type), growable(growable && type == Type::STRING), data(nullptr), data_size(data_size), links(0)
 {
     if (type == Type::ARRAY)
     {
-        this->data = new byte[data_size * sizeof(Link)];
-        new (this->data) Link[data_size];
+        this->data = allocate_elements(data_size * sizeof(Link));
+    }
+    else if (type == Type::MAP)
+    {
+        this->data = reinterpret_cast<byte *>(new Map());
+        this->data_size = 0;
     }
     else
     {
-        this->data = new byte[data_size];
+        this->data = new byte[this->growable ? growable_capacity(data_size) : data_size];
         std::copy(data, data + data_size, this->data);
     }
 }
 
+Object::Object(std::size_t size, Type element)
+    : type(Type::ARRAY), element(element == Type::I32 || element == Type::USIZE ? element : Type::VOID), data(nullptr), data_size(size), links(0)
+{
+    data = allocate_elements(capacity());
+}
+
+std::size_t vm::runtime::Object::capacity() const
+{
+    if (type == Type::ARRAY)
+        return data_size * (element == Type::VOID ? sizeof(Link) : sizeof(u32));
+    if (type == Type::MAP)
+        return map().bytes();
+    return growable ? growable_capacity(data_size) : data_size;
+}
+
+void vm::runtime::Object::append(const byte *bytes, std::size_t count)
+{
+    std::size_t size = data_size + count;
+    if (growable_capacity(size) != growable_capacity(data_size))
+    {
+        byte *grown = new byte[growable_capacity(size)];
+        std::memcpy(grown, data, data_size);
+        delete[] data;
+        data = grown;
+    }
+    std::memcpy(data + data_size, bytes, count);
+    data_size = size;
+}
+
+namespace
+{
+    // Element of an array: the object it links, or the type and value of a raw element
+    struct Element
+    {
+        const Object *object = nullptr;
+        Type type = Type::VOID;
+        u32 value = 0;
+    };
+
+    Element element_at(const Object &array, std::size_t position)
+    {
+        if (array.element == Type::VOID)
+            return {reinterpret_cast<const Link *>(array.data)[position].object};
+        return {nullptr, array.element, reinterpret_cast<const u32 *>(array.data)[position]};
+    }
+
+    // A raw element equals a boxed number of its type and value
+    bool raw_equal(const Element &raw, const Element &other)
+    {
+        if (other.object == nullptr)
+            return other.type == raw.type && other.value == raw.value;
+        return other.object->type == raw.type && static_cast<u32>(*other.object) == raw.value;
+    }
+}
+
 bool vm::runtime::Object::operator==(const Object &other) const
 {
-    return type == other.type &&
-           data_size == other.data_size &&
-           std::equal(data, data + data_size, other.data);
+    if (this == &other)
+        return true;
+    if ((interned && other.interned) || type == Type::MAP || other.type == Type::MAP)
+        return false;
+    if (type != other.type || data_size != other.data_size)
+        return false;
+    if (type != Type::ARRAY)
+    {
+        // memcmp is vectorized by the C library, which matters for long strings
+        return data_size == 0 || std::memcmp(data, other.data, data_size) == 0;
+    }
+
+    // Nested arrays are compared with an explicit stack. A pair met again is assumed equal, which ends
+    // the walk over arrays that contain themselves
+    std::vector<std::pair<const Object *, const Object *>> pending{{this, &other}};
+    std::vector<std::pair<const Object *, const Object *>> visited;
+    while (!pending.empty())
+    {
+        auto [left, right] = pending.back();
+        pending.pop_back();
+        if (std::find(visited.begin(), visited.end(), std::make_pair(left, right)) != visited.end())
+            continue;
+        visited.emplace_back(left, right);
+        if (left->element != Type::VOID && left->element == right->element)
+        {
+            if (left->data_size != 0 && std::memcmp(left->data, right->data, left->capacity()) != 0)
+                return false;
+            continue;
+        }
+        for (std::size_t i = 0; i < left->data_size; ++i)
+        {
+            Element first = element_at(*left, i), second = element_at(*right, i);
+            if (first.object == nullptr && first.type != Type::VOID)
+            {
+                if (!raw_equal(first, second))
+                    return false;
+            }
+            else if (second.object == nullptr && second.type != Type::VOID)
+            {
+                if (!raw_equal(second, first))
+                    return false;
+            }
+            else if (first.object == nullptr || second.object == nullptr)
+            {
+                if (first.object != second.object)
+                    return false;
+            }
+            else if (first.object->type == Type::ARRAY && second.object->type == Type::ARRAY)
+            {
+                if (first.object != second.object)
+                {
+                    if (first.object->data_size != second.object->data_size)
+                        return false;
+                    pending.emplace_back(first.object, second.object);
+                }
+            }
+            else if (*first.object != *second.object)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int vm::runtime::Object::compare(const Object &other) const
+{
+    if (*this == other)
+        return 0;
+    std::size_t common = std::min(data_size, other.data_size);
+    int order = common == 0 ? 0 : std::memcmp(data, other.data, common);
+    if (order != 0)
+        return order;
+    return data_size < other.data_size ? -1 : 1;
 }
 
 bool vm::runtime::Object::operator!=(const Object &other) const
@@ -37,7 +202,12 @@ bool vm::runtime::Object::operator<=(const Object &other) const
         return static_cast<int>(*this) <= static_cast<int>(other);
     case runtime::Type::USIZE:
         return static_cast<u32>(*this) <= static_cast<u32>(other);
+    case runtime::Type::STRING:
+        if (other.type == runtime::Type::STRING)
+            return compare(other) <= 0;
+        [[fallthrough]];
     default:
+        // The data of arrays holds links, whose order would change from run to run
         return static_cast<std::string>(*this) <= static_cast<std::string>(other);
     }
 }
@@ -50,7 +220,12 @@ bool vm::runtime::Object::operator>=(const Object &other) const
         return static_cast<int>(*this) >= static_cast<int>(other);
     case runtime::Type::USIZE:
         return static_cast<u32>(*this) >= static_cast<u32>(other);
+    case runtime::Type::STRING:
+        if (other.type == runtime::Type::STRING)
+            return compare(other) >= 0;
+        [[fallthrough]];
     default:
+        // The data of arrays holds links, whose order would change from run to run
         return static_cast<std::string>(*this) >= static_cast<std::string>(other);
     }
 }
@@ -67,7 +242,11 @@ bool vm::runtime::Object::operator>(const Object &other) const
 
 Object::operator bool() const
 {
-    for (std::size_t i = 0; i < data_size; ++i)
+    if (type == Type::MAP)
+        return data_size != 0;
+    // Raw elements take 4 bytes each and links are empty when all their bytes are zero
+    std::size_t bytes = type == Type::ARRAY ? capacity() : data_size;
+    for (std::size_t i = 0; i < bytes; ++i)
     {
         if (data[i])
         {
@@ -90,56 +269,138 @@ vm::runtime::Object::operator u32() const
 vm::runtime::Object::operator std::string() const
 {
     std::string result;
-    switch (type)
-    {
-    case Type::I32:
-    {
-        result = std::to_string(static_cast<int>(*this));
-        break;
-    }
-    case Type::USIZE:
-    {
-        result = std::to_string(static_cast<u32>(*this));
-        break;
-    }
-    case Type::STRING:
+    format(result);
+    return result;
+}
+
+template <typename T>
+static void append_number(std::string &buffer, T value)
+{
+    std::size_t size = buffer.size();
+    buffer.resize(size + std::numeric_limits<T>::digits10 + 2);
+    char *end = std::to_chars(buffer.data() + size, buffer.data() + buffer.size(), value).ptr;
+    buffer.resize(end - buffer.data());
+}
+
+void vm::runtime::Object::format(std::string &buffer) const
+{
+    // Nested arrays and maps are walked with an explicit stack of (container, next index) instead of
+    // recursion. The index of a map is a slot index
+    std::vector<std::pair<const Object *, std::size_t>> arrays;
+    const Object *current = this;
+    while (true)
     {
-        for (std::size_t i = 0; i < data_size; ++i)
+        switch (current->type)
+        {
+        case Type::I32:
         {
-            result.push_back(data[i]);
+            append_number(buffer, static_cast<int>(*current));
+            break;
         }
-        break;
-    }
-    case Type::ARRAY:
-    {
-        result = "[";
-        for (std::size_t i = 0; i < data_size; ++i)
+        case Type::USIZE:
+        {
+            append_number(buffer, static_cast<u32>(*current));
+            break;
+        }
+        case Type::STRING:
+        {
+            buffer.append(reinterpret_cast<const char *>(current->data), current->data_size);
+            break;
+        }
+        case Type::ARRAY:
         {
-            Link *links = reinterpret_cast<Link *>(data);
-            if (i > 0)
-                result += ", ";
-            if (links[i].object == nullptr)
+            buffer.push_back('[');
+            if (current->element == Type::VOID)
             {
-                result += "...";
+                arrays.emplace_back(current, 0);
                 break;
             }
-            result += static_cast<std::string>(*(links[i].object));
+            const u32 *elements = reinterpret_cast<const u32 *>(current->data);
+            for (std::size_t i = 0; i < current->data_size; ++i)
+            {
+                if (i > 0)
+                    buffer += ", ";
+                if (current->element == Type::I32)
+                    append_number(buffer, static_cast<int>(elements[i]));
+                else
+                    append_number(buffer, elements[i]);
+            }
+            buffer.push_back(']');
+            break;
         }
-        result.push_back(']');
-        break;
-    }
-    default:
-    {
-        result = std::to_string(reinterpret_cast<std::size_t>(this));
-        break;
-    }
+        case Type::MAP:
+        {
+            buffer.push_back('{');
+            arrays.emplace_back(current, 0);
+            break;
+        }
+        default:
+        {
+            append_number(buffer, reinterpret_cast<std::size_t>(current));
+            break;
+        }
+        }
+
+        current = nullptr;
+        while (current == nullptr && !arrays.empty())
+        {
+            auto &[array, index] = arrays.back();
+            if (array->type == Type::MAP)
+            {
+                const Map &map = array->map();
+                bool first = index == 0;
+                index = map.next(index);
+                if (index == map.slots())
+                {
+                    buffer.push_back('}');
+                    arrays.pop_back();
+                    continue;
+                }
+                if (!first)
+                    buffer += ", ";
+                // Keys are numbers and strings in all but odd programs, those print without nesting
+                map.key(index)->format(buffer);
+                buffer += ": ";
+                current = map.value(index++);
+                continue;
+            }
+            if (index == array->data_size)
+            {
+                buffer.push_back(']');
+                arrays.pop_back();
+                continue;
+            }
+            if (index > 0)
+                buffer += ", ";
+            current = reinterpret_cast<const Link *>(array->data)[index].object;
+            if (current == nullptr)
+            {
+                buffer += "...";
+                index = array->data_size;
+            }
+            else
+            {
+                ++index;
+            }
+        }
+        if (current == nullptr)
+            return;
     }
-    return result;
+}
+
+Map &vm::runtime::Object::map() const
+{
+    return *reinterpret_cast<Map *>(data);
 }
 
 Object::~Object()
 {
-    delete[] data;
+    if (type == Type::MAP)
+        delete &map();
+    else if (type == Type::ARRAY)
+        free_elements(data, capacity());
+    else
+        delete[] data;
 }
 
 vm::runtime::Link::Link()
@@ -190,13 +451,301 @@ GlobalVariables::~GlobalVariables()
     }
 }
 
-vm::Environment::Environment(
-    memory::Allocator &allocator,
-    code::Header &&header,
+Object *vm::runtime::StringTable::find(std::string_view value) const
+{
+    auto found = strings.find(value);
+    return found == strings.end() ? nullptr : found->second.object;
+}
+
+Object *vm::runtime::StringTable::add(Object *string)
+{
+    std::string_view value(reinterpret_cast<const char *>(string->data), string->data_size);
+    auto [entry, added] = strings.try_emplace(value);
+    if (added)
+    {
+        entry->second = string;
+        string->interned = true;
+    }
+    return entry->second.object;
+}
+
+std::size_t vm::runtime::StringTable::size() const
+{
+    return strings.size();
+}
+
+// Control bytes of free slots have the high bit set, occupied ones hold 7 bits of the hash
+static constexpr byte EMPTY = 0x80;
+static constexpr byte DELETED = 0xFE;
+static constexpr std::size_t GROUP = 16;
+
+// Bit i is set when control byte i of the group equals the value
+static unsigned match(const byte *group, byte value)
+{
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(value)))));
+#else
+    unsigned mask = 0;
+    for (std::size_t i = 0; i < GROUP; ++i)
+        mask |= static_cast<unsigned>(group[i] == value) << i;
+    return mask;
+#endif
+}
+
+// Bit i is set when slot i of the group is empty or deleted
+static unsigned match_free(const byte *group)
+{
+#if defined(__SSE2__)
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group))));
+#else
+    unsigned mask = 0;
+    for (std::size_t i = 0; i < GROUP; ++i)
+        mask |= static_cast<unsigned>(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static std::size_t mix(std::uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    return static_cast<std::size_t>(value ^ (value >> 33));
+}
+
+static bool same_key(const Object *left, const Object *right)
+{
+    if (left == right)
+        return true;
+    if (left->type != right->type || left->type == Type::ARRAY || left->type == Type::MAP)
+        return false;
+    return *left == *right;
+}
+
+std::size_t vm::runtime::Map::hash(const Object *key)
+{
+    switch (key->type)
+    {
+    case Type::I32:
+    case Type::USIZE:
+        return mix(static_cast<std::uint64_t>(key->type) << 32 | static_cast<u32>(*key));
+    case Type::STRING:
+        return mix(std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char *>(key->data), key->data_size)));
+    default:
+        return mix(reinterpret_cast<std::uintptr_t>(key));
+    }
+}
+
+// Groups are probed in triangular steps, which visits every group of a power of two count. A group that
+// has an empty slot ends the search, no key was ever placed past it
+std::size_t vm::runtime::Map::locate(const Object *key, std::size_t hash, bool &found) const
+{
+    found = false;
+    std::size_t mask = capacity / GROUP - 1;
+    std::size_t group = (hash >> 7) & mask;
+    std::size_t available = capacity;
+    for (std::size_t step = 1;; ++step)
+    {
+        const byte *bytes = control + group * GROUP;
+        for (unsigned candidates = match(bytes, hash & 0x7F); candidates != 0; candidates &= candidates - 1)
+        {
+            std::size_t slot = group * GROUP + static_cast<std::size_t>(std::countr_zero(candidates));
+            if (entries[slot].hash == hash && same_key(entries[slot].key.object, key))
+            {
+                found = true;
+                return slot;
+            }
+        }
+        unsigned free = match_free(bytes);
+        if (available == capacity && free != 0)
+            available = group * GROUP + static_cast<std::size_t>(std::countr_zero(free));
+        if (match(bytes, EMPTY) != 0)
+            return available;
+        group = (group + step) & mask;
+    }
+}
+
+// Moves every entry into new slots, which drops the tombstones of removed keys. Links move with their
+// objects, so link counts do not change
+void vm::runtime::Map::rehash(std::size_t size)
+{
+    byte *old_control = control;
+    Slot *old_entries = entries;
+    std::size_t old_capacity = capacity;
+    control = new byte[size];
+    std::fill_n(control, size, EMPTY);
+    entries = new Slot[size];
+    capacity = size;
+    tombstones = 0;
+    for (std::size_t i = 0; i < old_capacity; ++i)
+    {
+        if (old_control[i] & EMPTY)
+            continue;
+        bool found = false;
+        std::size_t slot = locate(old_entries[i].key.object, old_entries[i].hash, found);
+        control[slot] = old_control[i];
+        entries[slot].key.object = std::exchange(old_entries[i].key.object, nullptr);
+        entries[slot].value.object = std::exchange(old_entries[i].value.object, nullptr);
+        entries[slot].hash = old_entries[i].hash;
+    }
+    delete[] old_control;
+    delete[] old_entries;
+}
+
+Object *vm::runtime::Map::find(const Object *key) const
+{
+    if (count == 0)
+        return nullptr;
+    bool found = false;
+    std::size_t slot = locate(key, hash(key), found);
+    return found ? entries[slot].value.object : nullptr;
+}
+
+void vm::runtime::Map::put(Object *key, Object *value)
+{
+    std::size_t key_hash = hash(key);
+    bool found = false;
+    std::size_t slot = capacity == 0 ? 0 : locate(key, key_hash, found);
+    if (found)
+    {
+        entries[slot].value = value;
+        return;
+    }
+    // At most 7/8 of the slots are taken, so every probe sequence reaches an empty slot
+    if ((count + tombstones + 1) * 8 > capacity * 7)
+    {
+        rehash(std::max(GROUP, std::bit_ceil((count + 1) * 2)));
+        slot = locate(key, key_hash, found);
+    }
+    if (control[slot] == DELETED)
+        --tombstones;
+    control[slot] = static_cast<byte>(key_hash & 0x7F);
+    entries[slot].key = key;
+    entries[slot].value = value;
+    entries[slot].hash = key_hash;
+    ++count;
+}
+
+bool vm::runtime::Map::remove(const Object *key)
+{
+    if (count == 0)
+        return false;
+    bool found = false;
+    std::size_t slot = locate(key, hash(key), found);
+    if (!found)
+        return false;
+    // A group that still has an empty slot never made a probe go on, so the slot can be empty again
+    if (match(control + slot / GROUP * GROUP, EMPTY) != 0)
+    {
+        control[slot] = EMPTY;
+    }
+    else
+    {
+        control[slot] = DELETED;
+        ++tombstones;
+    }
+    std::exchange(entries[slot].key.object, nullptr)->links--;
+    std::exchange(entries[slot].value.object, nullptr)->links--;
+    --count;
+    return true;
+}
+
+std::size_t vm::runtime::Map::size() const
+{
+    return count;
+}
+
+std::size_t vm::runtime::Map::bytes() const
+{
+    return capacity * (sizeof(Slot) + 1);
+}
+
+void vm::runtime::Map::release()
+{
+    for (std::size_t i = 0; i < capacity; ++i)
+    {
+        entries[i].key.object = nullptr;
+        entries[i].value.object = nullptr;
+    }
+}
+
+std::size_t vm::runtime::Map::next(std::size_t index) const
+{
+    while (index < capacity && (control[index] & EMPTY))
+        ++index;
+    return index;
+}
+
+std::size_t vm::runtime::Map::slots() const
+{
+    return capacity;
+}
+
+Object *vm::runtime::Map::key(std::size_t slot) const
+{
+    return entries[slot].key.object;
+}
+
+Object *vm::runtime::Map::value(std::size_t slot) const
+{
+    return entries[slot].value.object;
+}
+
+vm::runtime::Map::~Map()
+{
+    delete[] control;
+    delete[] entries;
+}
+
+vm::Image::Image(
+    std::shared_ptr<const std::vector<byte>> bytes,
+    code::Header header,
     code::ConstantPool &&pool,
-    runtime::GlobalVariables &&global,
+    u16 global_count,
     code::FunctionTable &&functions,
-    code::IntrinsicTable &&intrinsics)
-    : allocator(std::move(allocator)), header(std::move(header)), constant_pool(std::move(pool)), global(std::move(global)), functions(std::move(functions)), intrinsics(std::move(intrinsics))
+    code::IntrinsicTable &&intrinsics,
+    std::size_t body_offset,
+    u32 body_length)
+    : bytes(std::move(bytes)), header(header), constant_pool(std::move(pool)), global_count(global_count), functions(std::move(functions)), intrinsics(std::move(intrinsics)), body_offset(body_offset), body_length(body_length)
+{
+}
+
+vm::code::Reader vm::Image::reader() const
+{
+    if (!bytes)
+        throw std::logic_error("Image was loaded without keeping its bytes");
+    return code::Reader(bytes);
+}
+
+// Constants are pushed onto the stack and their link counts change, so every isolate gets its own copies
+static vm::code::ConstantPool copy_constants(const vm::code::ConstantPool &pool)
 {
-}
\ No newline at end of file
+    Object **data = new Object *[pool.size];
+    for (u16 i = 0; i < pool.size; ++i)
+        data[i] = new Object(pool.data[i]->type, pool.data[i]->data, pool.data[i]->data_size);
+    return {pool.size, data};
+}
+
+vm::Environment::Environment(std::shared_ptr<Image> image, memory::Allocator allocator)
+    : image(image),
+      allocator(std::move(allocator)),
+      header(image->header),
+      constant_pool(copy_constants(image->constant_pool)),
+      global(image->global_count, new Link[image->global_count]),
+      functions(image->functions),
+      intrinsics(image->intrinsics),
+      calls(image->functions.size, 0),
+      output(&std::cout)
+{
+    for (u16 i = 0; i < constant_pool.size; ++i)
+    {
+        Object *constant = constant_pool.data[i];
+        if (constant->type != Type::STRING)
+            continue;
+        constant_pool.data[i] = strings.add(constant);
+        if (constant_pool.data[i] != constant)
+            delete constant;
+    }
+}
@@ -0,0 +1,281 @@
+#include "vm.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace vm;
+
+namespace
+{
+    constexpr char OUTPUT = 'o';
+    constexpr char DONE = 'd';
+    constexpr char STOP = 's';
+    // How long a client may take to send its request
+    constexpr int REQUEST_TIMEOUT_MS = 10000;
+
+    std::runtime_error socket_error(const std::string &what)
+    {
+        return std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    sockaddr_un socket_address(const fs::path &path)
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.string().size() >= sizeof(address.sun_path))
+            throw std::invalid_argument("Socket path is too long: " + path.string());
+        std::strcpy(address.sun_path, path.c_str());
+        return address;
+    }
+
+    bool write_all(int socket, const void *data, std::size_t size)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t written = ::send(socket, bytes, size, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            bytes += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    // With a stop descriptor, gives up once it becomes readable or the socket stays silent for
+    // REQUEST_TIMEOUT_MS, so a client that never sends its request does not keep the server running
+    bool read_all(int socket, void *data, std::size_t size, int stop = -1)
+    {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0)
+        {
+            if (stop >= 0)
+            {
+                pollfd descriptors[2] = {{socket, POLLIN, 0}, {stop, POLLIN, 0}};
+                int ready = ::poll(descriptors, 2, REQUEST_TIMEOUT_MS);
+                if (ready < 0 && errno == EINTR)
+                    continue;
+                if (ready <= 0 || descriptors[1].revents != 0)
+                    return false;
+            }
+            ssize_t count = ::recv(socket, bytes, size, 0);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            bytes += count;
+            size -= static_cast<std::size_t>(count);
+        }
+        return true;
+    }
+
+    // A frame is its kind, the length of its payload in host order and the payload
+    bool write_frame(int socket, char kind, std::string_view payload)
+    {
+        u32 length = static_cast<u32>(payload.size());
+        return write_all(socket, &kind, 1) && write_all(socket, &length, sizeof(length)) &&
+               write_all(socket, payload.data(), payload.size());
+    }
+
+    bool read_frame(int socket, char &kind, std::string &payload)
+    {
+        u32 length;
+        if (!read_all(socket, &kind, 1) || !read_all(socket, &length, sizeof(length)))
+            return false;
+        payload.resize(length);
+        return read_all(socket, payload.data(), length);
+    }
+
+    // Unbuffered, so every println reaches the client as soon as it is written
+    class SocketBuffer : public std::streambuf
+    {
+    public:
+        explicit SocketBuffer(int socket) : socket(socket) {}
+
+    protected:
+        int overflow(int c) override
+        {
+            if (c == traits_type::eof())
+                return traits_type::not_eof(c);
+            char value = static_cast<char>(c);
+            return write_frame(socket, OUTPUT, std::string_view(&value, 1)) ? c : traits_type::eof();
+        }
+
+        std::streamsize xsputn(const char *data, std::streamsize count) override
+        {
+            return write_frame(socket, OUTPUT, std::string_view(data, static_cast<std::size_t>(count))) ? count : 0;
+        }
+
+    private:
+        int socket;
+    };
+}
+
+server::Server::Server(const fs::path &socket) : path(socket)
+{
+    sockaddr_un address = socket_address(path);
+    listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        throw socket_error("Cannot create socket");
+    // A socket file left behind by a server that did not exit cleanly would make bind fail
+    if (fs::is_socket(path))
+        fs::remove(path);
+    if (::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listener, SOMAXCONN) != 0)
+    {
+        int saved = errno;
+        ::close(listener);
+        errno = saved;
+        throw socket_error("Cannot listen on " + path.string());
+    }
+    if (::pipe(stop_pipe) != 0)
+    {
+        ::close(listener);
+        throw socket_error("Cannot create server pipe");
+    }
+}
+
+server::Server::~Server()
+{
+    ::close(listener);
+    ::close(stop_pipe[0]);
+    ::close(stop_pipe[1]);
+    std::error_code ignored;
+    fs::remove(path, ignored);
+}
+
+std::shared_ptr<Image> server::Server::preload(const fs::path &program)
+{
+    return images.get(program);
+}
+
+void server::Server::run()
+{
+    pollfd descriptors[2] = {{listener, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    while (true)
+    {
+        if (::poll(descriptors, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw socket_error("Cannot wait for clients");
+        }
+        if (descriptors[1].revents != 0)
+            break;
+        int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+        std::lock_guard<std::mutex> lock(mutex);
+        ++active;
+        std::thread(&Server::serve_client, this, client).detach();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]
+              { return active == 0; });
+}
+
+void server::Server::stop()
+{
+    [[maybe_unused]] ssize_t written = ::write(stop_pipe[1], &STOP, 1);
+}
+
+const batch::ImageCache &server::Server::image_cache() const
+{
+    return images;
+}
+
+// One request per connection: a debug flag byte, then the length of the program path and the path.
+// The answer is a stream of output frames ended by a done frame carrying the error, empty on success
+void server::Server::serve_client(int client)
+{
+    byte debug_mode;
+    u32 length;
+    std::string program;
+    if (read_all(client, &debug_mode, 1, stop_pipe[0]) && read_all(client, &length, sizeof(length), stop_pipe[0]))
+    {
+        program.resize(length);
+        if (read_all(client, program.data(), length, stop_pipe[0]))
+        {
+            SocketBuffer buffer(client);
+            std::ostream output(&buffer);
+            std::string error;
+            try
+            {
+                Environment env(images.get(program));
+                env.output = &output;
+                vm::run(env, debug_mode != 0);
+            }
+            catch (const runtime::HaltException &e)
+            {
+                error = e.getMessage();
+            }
+            catch (const code::InvalidBytecodeException &e)
+            {
+                error = e.getMessage();
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            write_frame(client, DONE, error.empty() ? std::string_view() : std::string_view(error));
+        }
+    }
+    ::close(client);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--active == 0)
+        idle.notify_all();
+}
+
+int server::request(const fs::path &socket, const fs::path &program, bool debug_mode, std::ostream &output, std::ostream &errors)
+{
+    sockaddr_un address = socket_address(socket);
+    int connection = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0)
+        throw socket_error("Cannot create socket");
+    if (::connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        int saved = errno;
+        ::close(connection);
+        errno = saved;
+        throw socket_error("Cannot connect to " + socket.string());
+    }
+
+    std::string path = fs::absolute(program).string();
+    byte flag = debug_mode ? 1 : 0;
+    u32 length = static_cast<u32>(path.size());
+    bool sent = write_all(connection, &flag, 1) && write_all(connection, &length, sizeof(length)) &&
+                write_all(connection, path.data(), path.size());
+
+    char kind = 0;
+    std::string payload;
+    while (sent && read_frame(connection, kind, payload) && kind == OUTPUT)
+    {
+        output.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        output.flush();
+    }
+    ::close(connection);
+
+    if (kind != DONE)
+    {
+        errors << "Connection to " << socket.string() << " was lost\n";
+        return EXIT_FAILURE;
+    }
+    if (!payload.empty())
+    {
+        errors << program.string() << ": " << payload << '\n';
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
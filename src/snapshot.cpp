@@ -0,0 +1,299 @@
+#include "vm.hpp"
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vm;
+
+// A snapshot is written in host byte order, it is meant for the machine that made it:
+//   magic "SNSP", u16 version, u16 global count, u64 program hash, u64 resume offset, u32 object count,
+//   objects as u8 type, u8 element type for arrays, u32 site, u64 data size and the data, or the object
+//   ids of the elements of arrays of links, then the object id of every global. Ids index the objects in
+//   file order, NONE is an empty link
+namespace
+{
+    constexpr char MAGIC[4] = {'S', 'N', 'S', 'P'};
+    constexpr u16 VERSION = 2;
+    constexpr u32 NONE = 0xFFFFFFFFU;
+
+    std::uint64_t program_hash(const Environment &env)
+    {
+        if (!env.image->bytes)
+            throw std::logic_error("Snapshots need an image loaded with its bytes");
+        return content_hash(*env.image->bytes);
+    }
+
+    template <typename T>
+    void put(std::ostream &output, T value)
+    {
+        output.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    // Gives every object reachable from the globals an id, in breadth-first order
+    std::vector<const runtime::Object *> reachable(const Environment &env, std::unordered_map<const runtime::Object *, u32> &ids)
+    {
+        std::vector<const runtime::Object *> objects;
+        auto visit = [&objects, &ids](const runtime::Object *object)
+        {
+            if (object != nullptr && ids.emplace(object, static_cast<u32>(objects.size())).second)
+                objects.push_back(object);
+        };
+        for (u16 i = 0; i < env.global.size; ++i)
+            visit(env.global.variables[i].object);
+        for (std::size_t next = 0; next < objects.size(); ++next)
+        {
+            if (objects[next]->type == runtime::Type::MAP)
+            {
+                const runtime::Map &map = objects[next]->map();
+                for (std::size_t slot = map.next(0); slot < map.slots(); slot = map.next(slot + 1))
+                {
+                    visit(map.key(slot));
+                    visit(map.value(slot));
+                }
+                continue;
+            }
+            if (objects[next]->type != runtime::Type::ARRAY || objects[next]->element != runtime::Type::VOID)
+                continue;
+            const runtime::Link *elements = reinterpret_cast<const runtime::Link *>(objects[next]->data);
+            for (std::size_t i = 0; i < objects[next]->data_size; ++i)
+                visit(elements[i].object);
+        }
+        return objects;
+    }
+
+    void write(const fs::path &file, const Environment &env, std::size_t resume_offset)
+    {
+        std::unordered_map<const runtime::Object *, u32> ids;
+        std::vector<const runtime::Object *> objects = reachable(env, ids);
+        auto id = [&ids](const runtime::Object *object)
+        {
+            return object == nullptr ? NONE : ids.at(object);
+        };
+
+        std::ofstream output(file, std::ios::binary | std::ios::trunc);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot write snapshot " + file.string());
+        output.write(MAGIC, sizeof(MAGIC));
+        put(output, VERSION);
+        put(output, env.global.size);
+        put<std::uint64_t>(output, program_hash(env));
+        put<std::uint64_t>(output, resume_offset);
+        put(output, static_cast<u32>(objects.size()));
+        for (const runtime::Object *object : objects)
+        {
+            put(output, static_cast<byte>(object->type));
+            if (object->type == runtime::Type::ARRAY)
+                put(output, static_cast<byte>(object->element));
+            put(output, object->site);
+            put<std::uint64_t>(output, object->data_size);
+            if (object->type == runtime::Type::ARRAY && object->element != runtime::Type::VOID)
+            {
+                output.write(reinterpret_cast<const char *>(object->data), static_cast<std::streamsize>(object->data_size * sizeof(u32)));
+            }
+            else if (object->type == runtime::Type::ARRAY)
+            {
+                const runtime::Link *elements = reinterpret_cast<const runtime::Link *>(object->data);
+                for (std::size_t i = 0; i < object->data_size; ++i)
+                    put(output, id(elements[i].object));
+            }
+            else if (object->type == runtime::Type::MAP)
+            {
+                // data_size counts the entries, each is written as the ids of its key and value
+                const runtime::Map &map = object->map();
+                for (std::size_t slot = map.next(0); slot < map.slots(); slot = map.next(slot + 1))
+                {
+                    put(output, id(map.key(slot)));
+                    put(output, id(map.value(slot)));
+                }
+            }
+            else
+            {
+                output.write(reinterpret_cast<const char *>(object->data), static_cast<std::streamsize>(object->data_size));
+            }
+        }
+        for (u16 i = 0; i < env.global.size; ++i)
+            put(output, id(env.global.variables[i].object));
+        if (!output)
+            throw std::runtime_error("Cannot write snapshot " + file.string());
+    }
+
+    // The whole file is mapped, restoring it reads the pages once front to back
+    class Mapping
+    {
+    public:
+        explicit Mapping(const fs::path &file)
+        {
+            int descriptor = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (descriptor < 0)
+                throw std::runtime_error("Cannot open snapshot " + file.string() + ": " + std::strerror(errno));
+            struct stat status;
+            if (::fstat(descriptor, &status) == 0 && status.st_size > 0)
+            {
+                size = static_cast<std::size_t>(status.st_size);
+                void *address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (address != MAP_FAILED)
+                {
+                    data = static_cast<const byte *>(address);
+                    ::madvise(address, size, MADV_WILLNEED);
+                }
+            }
+            ::close(descriptor);
+            if (data == nullptr)
+                throw std::runtime_error("Cannot map snapshot " + file.string());
+        }
+        Mapping(const Mapping &) = delete;
+        ~Mapping() { ::munmap(const_cast<byte *>(data), size); }
+
+        template <typename T>
+        T take()
+        {
+            T value;
+            std::memcpy(&value, bytes(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        std::size_t remaining() const
+        {
+            return size - position;
+        }
+
+        const byte *bytes(std::size_t count)
+        {
+            if (count > size - position)
+                throw code::InvalidBytecodeException("Snapshot is truncated");
+            const byte *start = data + position;
+            position += count;
+            return start;
+        }
+
+    private:
+        const byte *data = nullptr;
+        std::size_t size = 0;
+        std::size_t position = 0;
+    };
+}
+
+void snapshot::create(const fs::path &file, Environment &env, bool debug_mode)
+{
+    const Image &image = *env.image;
+    std::size_t body_end = image.body_offset + image.body_length;
+    std::size_t resume_offset = body_end;
+    code::Reader reader = image.reader();
+    reader.set_offset(image.body_offset);
+    env.stop_at_snapshot = true;
+    try
+    {
+        process(reader, env, image.body_length, 0, debug_mode);
+    }
+    catch (const Point &)
+    {
+        resume_offset = reader.get_offset();
+        if (resume_offset < image.body_offset || resume_offset > body_end)
+            throw code::InvalidBytecodeException("The snapshot intrinsic can only be called from the main body");
+        if (!env.stack.empty())
+            throw code::InvalidBytecodeException("The stack must be empty at the snapshot point");
+    }
+    env.stop_at_snapshot = false;
+    write(file, env, resume_offset);
+}
+
+std::size_t snapshot::restore(const fs::path &file, Environment &env)
+{
+    Mapping snapshot(file);
+    if (std::memcmp(snapshot.bytes(sizeof(MAGIC)), MAGIC, sizeof(MAGIC)) != 0 || snapshot.take<u16>() != VERSION)
+        throw code::InvalidBytecodeException("Not a snapshot or written by another version: " + file.string());
+    if (snapshot.take<u16>() != env.global.size || snapshot.take<std::uint64_t>() != program_hash(env))
+        throw code::InvalidBytecodeException("Snapshot " + file.string() + " was made from another program");
+    std::size_t resume_offset = snapshot.take<std::uint64_t>();
+    u32 count = snapshot.take<u32>();
+    if (count > snapshot.remaining())
+        throw code::InvalidBytecodeException("Snapshot is truncated");
+
+    std::vector<runtime::Object *> objects(count);
+    std::vector<std::pair<runtime::Object *, const byte *>> arrays;
+    std::vector<std::pair<runtime::Object *, const byte *>> maps;
+    env.allocator.reserve(count);
+    u32 site = env.allocator.site;
+    for (u32 i = 0; i < count; ++i)
+    {
+        byte type = snapshot.take<byte>();
+        byte element = type == runtime::Type::ARRAY ? snapshot.take<byte>() : static_cast<byte>(runtime::Type::VOID);
+        env.allocator.site = snapshot.take<u32>();
+        std::uint64_t data_size = snapshot.take<std::uint64_t>();
+        if (data_size > std::numeric_limits<u32>::max())
+            throw code::InvalidBytecodeException("Snapshot object is too large");
+        if (type == runtime::Type::ARRAY)
+        {
+            objects[i] = env.allocator.create_array(data_size, static_cast<runtime::Type>(element));
+            if (objects[i]->element == runtime::Type::VOID)
+                arrays.emplace_back(objects[i], snapshot.bytes(data_size * sizeof(u32)));
+            else
+                std::memcpy(objects[i]->data, snapshot.bytes(data_size * sizeof(u32)), data_size * sizeof(u32));
+        }
+        else if (type == runtime::Type::MAP)
+        {
+            objects[i] = env.allocator.create(runtime::Type::MAP, nullptr, 0);
+            objects[i]->data_size = data_size;
+            maps.emplace_back(objects[i], snapshot.bytes(data_size * 2 * sizeof(u32)));
+        }
+        else if (type == runtime::Type::I32 || type == runtime::Type::USIZE || type == runtime::Type::STRING)
+        {
+            objects[i] = env.allocator.create(static_cast<runtime::Type>(type), snapshot.bytes(data_size), data_size);
+        }
+        else
+        {
+            throw code::InvalidBytecodeException("Unexpected type in snapshot");
+        }
+    }
+    env.allocator.site = site;
+
+    auto object = [&objects](u32 id) -> runtime::Object *
+    {
+        if (id == NONE)
+            return nullptr;
+        if (id >= objects.size())
+            throw code::InvalidBytecodeException("Snapshot refers to a missing object");
+        return objects[id];
+    };
+    auto link = [&object](runtime::Link &target, u32 id)
+    {
+        runtime::Object *value = object(id);
+        if (value != nullptr)
+            target = value;
+    };
+    for (auto &[array, ids] : arrays)
+    {
+        runtime::Link *elements = reinterpret_cast<runtime::Link *>(array->data);
+        for (std::size_t i = 0; i < array->data_size; ++i)
+        {
+            u32 id;
+            std::memcpy(&id, ids + i * sizeof(u32), sizeof(u32));
+            link(elements[i], id);
+        }
+    }
+    for (auto &[map, ids] : maps)
+    {
+        std::size_t entries = std::exchange(map->data_size, 0);
+        for (std::size_t i = 0; i < entries; ++i)
+        {
+            u32 key, value;
+            std::memcpy(&key, ids + i * 2 * sizeof(u32), sizeof(u32));
+            std::memcpy(&value, ids + (i * 2 + 1) * sizeof(u32), sizeof(u32));
+            if (object(key) == nullptr || object(value) == nullptr)
+                throw code::InvalidBytecodeException("Snapshot map has an empty entry");
+            map->map().put(object(key), object(value));
+        }
+        map->data_size = map->map().size();
+    }
+    for (u16 i = 0; i < env.global.size; ++i)
+        link(env.global.variables[i], snapshot.take<u32>());
+    return resume_offset;
+}
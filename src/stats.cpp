@@ -0,0 +1,207 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace vm;
+
+namespace
+{
+    int dump_pipe[2] = {-1, -1};
+    std::thread dump_thread;
+    struct sigaction previous_action;
+
+    constexpr char DUMP = 'd';
+    constexpr char QUIT = 'q';
+
+    // Only async-signal-safe work here, the dump thread does the rest
+    void request_dump(int)
+    {
+        int saved = errno;
+        [[maybe_unused]] ssize_t written = ::write(dump_pipe[1], &DUMP, 1);
+        errno = saved;
+    }
+
+    void wait_for_dumps(fs::path path)
+    {
+        char message;
+        while (::read(dump_pipe[0], &message, 1) == 1 && message == DUMP)
+            stats::write_json(path);
+    }
+
+    std::uint64_t current(const stats::Counter &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    struct Totals
+    {
+        std::uint64_t instructions = 0, calls = 0, allocations = 0, collections = 0, objects_freed = 0,
+                      jit_compilations = 0, jit_functions = 0, jit_failures = 0;
+        std::uint64_t gc_pause[stats::Histogram::BUCKETS + 3] = {};
+        std::uint64_t jit_compile[stats::Histogram::BUCKETS + 3] = {};
+    };
+
+    // Buckets followed by count, sum and max
+    void accumulate(std::uint64_t *total, const stats::Histogram &histogram)
+    {
+        for (std::size_t i = 0; i < stats::Histogram::BUCKETS; ++i)
+            total[i] += current(histogram.buckets[i]);
+        total[stats::Histogram::BUCKETS] += current(histogram.count);
+        total[stats::Histogram::BUCKETS + 1] += current(histogram.sum);
+        total[stats::Histogram::BUCKETS + 2] = std::max(total[stats::Histogram::BUCKETS + 2], current(histogram.max));
+    }
+
+    void write_histogram(std::ostream &output, const std::uint64_t *histogram)
+    {
+        output << "{\"count\": " << histogram[stats::Histogram::BUCKETS]
+               << ", \"sum_ns\": " << histogram[stats::Histogram::BUCKETS + 1]
+               << ", \"max_ns\": " << histogram[stats::Histogram::BUCKETS + 2]
+               << ", \"buckets\": [";
+        bool first = true;
+        for (std::size_t i = 0; i < stats::Histogram::BUCKETS; ++i)
+        {
+            if (histogram[i] == 0)
+                continue;
+            output << (first ? "" : ", ") << "{\"below_ns\": " << (std::uint64_t{1} << i) << ", \"count\": " << histogram[i] << '}';
+            first = false;
+        }
+        output << "]}";
+    }
+
+    void accumulate(Totals &totals, const stats::Counters &counters)
+    {
+        totals.instructions += current(counters.instructions);
+        totals.calls += current(counters.calls);
+        totals.allocations += current(counters.allocations);
+        totals.collections += current(counters.collections);
+        totals.objects_freed += current(counters.objects_freed);
+        totals.jit_compilations += current(counters.jit_compilations);
+        totals.jit_functions += current(counters.jit_functions);
+        totals.jit_failures += current(counters.jit_failures);
+        accumulate(totals.gc_pause, counters.gc_pause);
+        accumulate(totals.jit_compile, counters.jit_compile);
+    }
+
+    // Counters of live threads, and the sums of the threads that have exited
+    std::mutex registry_mutex;
+    std::vector<stats::Counters *> registry;
+    Totals retired;
+    std::size_t retired_threads = 0;
+
+    // Registers the counters of its thread, and moves their counts into the retired totals when the
+    // thread exits, so servers that start a thread per request keep a fixed number of counters
+    class Registration
+    {
+    public:
+        Registration()
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry.push_back(&counters);
+        }
+
+        Registration(const Registration &) = delete;
+        Registration &operator=(const Registration &) = delete;
+
+        ~Registration()
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            accumulate(retired, counters);
+            ++retired_threads;
+            registry.erase(std::find(registry.begin(), registry.end(), &counters));
+        }
+
+        stats::Counters counters;
+    };
+}
+
+void stats::Histogram::record(std::chrono::nanoseconds duration)
+{
+    std::uint64_t value = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 0));
+    std::size_t bucket = std::min<std::size_t>(std::bit_width(value), BUCKETS - 1);
+    add(buckets[bucket]);
+    add(count);
+    add(sum, value);
+    if (value > max.load(std::memory_order_relaxed))
+        max.store(value, std::memory_order_relaxed);
+}
+
+stats::Counters &stats::local()
+{
+    thread_local Registration registration;
+    return registration.counters;
+}
+
+void stats::write_json(std::ostream &output)
+{
+    Totals totals;
+    std::size_t threads;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        totals = retired;
+        threads = registry.size() + retired_threads;
+        for (const Counters *counters : registry)
+            accumulate(totals, *counters);
+    }
+
+    output << "{\n"
+           << "  \"threads\": " << threads << ",\n"
+           << "  \"interpreter\": {\"instructions\": " << totals.instructions << ", \"calls\": " << totals.calls << "},\n"
+           << "  \"allocator\": {\"allocations\": " << totals.allocations
+           << ", \"collections\": " << totals.collections
+           << ", \"objects_freed\": " << totals.objects_freed << ", \"gc_pause\": ";
+    write_histogram(output, totals.gc_pause);
+    output << "},\n"
+           << "  \"jit\": {\"compilations\": " << totals.jit_compilations
+           << ", \"functions\": " << totals.jit_functions
+           << ", \"failures\": " << totals.jit_failures << ", \"compile_time\": ";
+    write_histogram(output, totals.jit_compile);
+    output << "}\n"
+           << "}\n";
+}
+
+void stats::write_json(const fs::path &path)
+{
+    if (path == "-")
+    {
+        write_json(std::cerr);
+        return;
+    }
+    std::ofstream output(path, std::ios::trunc);
+    write_json(output);
+}
+
+void stats::dump_on_signal(const fs::path &path)
+{
+    if (dump_thread.joinable())
+        throw std::logic_error("Statistics are already dumped on signal");
+    if (pipe(dump_pipe) != 0)
+        throw std::runtime_error(std::string("Cannot create statistics pipe: ") + std::strerror(errno));
+    dump_thread = std::thread(wait_for_dumps, path);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = request_dump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, &previous_action);
+}
+
+void stats::stop_dump_on_signal()
+{
+    if (!dump_thread.joinable())
+        return;
+
+    sigaction(SIGUSR1, &previous_action, nullptr);
+    [[maybe_unused]] ssize_t written = ::write(dump_pipe[1], &QUIT, 1);
+    dump_thread.join();
+    ::close(dump_pipe[0]);
+    ::close(dump_pipe[1]);
+    dump_pipe[0] = dump_pipe[1] = -1;
+}
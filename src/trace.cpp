@@ -0,0 +1,124 @@
+#include "vm.hpp"
+#include <charconv>
+#include <chrono>
+#include <limits>
+#include <string>
+
+using namespace vm::debug;
+using Command = vm::code::Command;
+
+Tracer::Tracer(std::ostream &output)
+    : records(new TraceRecord[CAPACITY]), head(0), tail(0), running(true), output(output), writer(&Tracer::write_records, this)
+{
+}
+
+void Tracer::record(const TraceRecord &record)
+{
+    std::size_t current = head.load(std::memory_order_relaxed);
+    while (current - tail.load(std::memory_order_acquire) == CAPACITY)
+    {
+        std::this_thread::yield();
+    }
+    records[current % CAPACITY] = record;
+    head.store(current + 1, std::memory_order_release);
+}
+
+void Tracer::flush()
+{
+    while (tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed))
+    {
+        std::this_thread::yield();
+    }
+}
+
+Tracer::~Tracer()
+{
+    running.store(false, std::memory_order_release);
+    writer.join();
+}
+
+template <typename T>
+static void append_number(std::string &buffer, T value, int base = 10)
+{
+    std::size_t size = buffer.size();
+    buffer.resize(size + std::numeric_limits<T>::digits + 2);
+    char *end = std::to_chars(buffer.data() + size, buffer.data() + buffer.size(), value, base).ptr;
+    buffer.resize(end - buffer.data());
+}
+
+static void append_record(std::string &buffer, const TraceRecord &record)
+{
+    append_number(buffer, record.offset, 16);
+    buffer += ": ";
+    buffer += vm::code::command_name(record.command);
+    switch (record.command)
+    {
+    case Command::JMP:
+    case Command::JMP_IF_FALSE:
+    case Command::JMP_IF_TRUE:
+        buffer.push_back(' ');
+        append_number(buffer, static_cast<std::int16_t>(record.operand));
+        break;
+    case Command::PUSH_CONST:
+    case Command::PUSH_LOCAL:
+    case Command::PUSH_GLOBAL:
+    case Command::STORE_LOCAL:
+    case Command::STORE_GLOBAL:
+    case Command::CALL:
+    case Command::NEW_ARRAY:
+    case Command::INIT_ARRAY:
+    case Command::INTRINSIC_CALL:
+        buffer.push_back(' ');
+        append_number(buffer, record.operand);
+        break;
+    }
+    buffer += " | stack ";
+    append_number(buffer, record.stack_size);
+    if (record.stack_size > 0)
+    {
+        buffer += " | top ";
+        switch (record.top_type)
+        {
+        case vm::runtime::Type::STRING:
+            buffer += "string of ";
+            break;
+        case vm::runtime::Type::ARRAY:
+            buffer += "array of ";
+            break;
+        case vm::runtime::Type::MAP:
+            buffer += "map of ";
+            break;
+        default:
+            break;
+        }
+        append_number(buffer, record.top_value);
+    }
+    buffer.push_back('\n');
+}
+
+void Tracer::write_records()
+{
+    std::string buffer;
+    while (true)
+    {
+        bool active = running.load(std::memory_order_acquire);
+        std::size_t current = tail.load(std::memory_order_relaxed);
+        std::size_t last = head.load(std::memory_order_acquire);
+        if (current == last)
+        {
+            if (!active)
+                return;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        buffer.clear();
+        for (; current != last; ++current)
+        {
+            append_record(buffer, records[current % CAPACITY]);
+        }
+        output.write(buffer.data(), buffer.size());
+        output.flush();
+        tail.store(last, std::memory_order_release);
+    }
+}
@@ -0,0 +1,210 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace vm;
+
+namespace
+{
+    long parameter(const workload::Parameters &parameters, const std::string &name, long fallback)
+    {
+        auto found = parameters.find(name);
+        return found == parameters.end() ? fallback : found->second;
+    }
+
+    // Constants 0, 1 and 2 are the literals 0, 1, 2, constant 3 is the workload size n
+    void write_prologue(std::ostream &source, const std::string &name, long n)
+    {
+        source << "; " << name << " workload, generated by ShellVM\n"
+               << ".version 1\n"
+               << ".main 0\n\n"
+               << ".const i32 0\n"
+               << ".const i32 1\n"
+               << ".const i32 2\n"
+               << ".const i32 " << n << "\n";
+    }
+
+    // for (local counter = 0; counter < local limit; ++counter) body
+    void write_loop(std::ostream &source, int counter, int limit, const std::string &body)
+    {
+        source << "    PUSH_CONST 0\n"
+               << "    STORE_LOCAL " << counter << "\n"
+               << "loop:\n"
+               << "    PUSH_LOCAL " << counter << "\n"
+               << "    PUSH_LOCAL " << limit << "\n"
+               << "    LT\n"
+               << "    JMP_IF_FALSE done\n"
+               << body
+               << "    PUSH_LOCAL " << counter << "\n"
+               << "    PUSH_CONST 1\n"
+               << "    ADD\n"
+               << "    STORE_LOCAL " << counter << "\n"
+               << "    JMP loop\n"
+               << "done:\n";
+    }
+
+    // Every workload is a function run(n), function 0, called once from the main body
+    void write_epilogue(std::ostream &source, const workload::Parameters &parameters)
+    {
+        source << "\n.intrinsic println 1 void\n\n"
+               << ".body\n"
+               << "    PUSH_CONST 3\n"
+               << "    CALL 0\n";
+        if (parameter(parameters, "print", 0) != 0)
+            source << "    INTRINSIC_CALL 0\n";
+        source << ".end\n";
+    }
+
+    void sum_loop(std::ostream &source, const workload::Parameters &parameters)
+    {
+        write_prologue(source, "sum_loop", parameter(parameters, "n", 100000));
+        source << "\n.function run 1 i32 2\n"
+               << "    STORE_LOCAL 0\n"
+               << "    PUSH_CONST 0\n"
+               << "    STORE_LOCAL 2\n";
+        write_loop(source, 1, 0,
+                   "    PUSH_LOCAL 2\n"
+                   "    PUSH_LOCAL 1\n"
+                   "    ADD\n"
+                   "    STORE_LOCAL 2\n");
+        source << "    PUSH_LOCAL 2\n"
+               << "    RET\n"
+               << ".end\n";
+        write_epilogue(source, parameters);
+    }
+
+    void fibonacci(std::ostream &source, const workload::Parameters &parameters)
+    {
+        write_prologue(source, "fibonacci", parameter(parameters, "n", 20));
+        source << "\n.function fib 1 i32 0\n"
+               << "    STORE_LOCAL 0\n"
+               << "    PUSH_LOCAL 0\n"
+               << "    PUSH_CONST 2\n"
+               << "    LT\n"
+               << "    JMP_IF_FALSE recurse\n"
+               << "    PUSH_LOCAL 0\n"
+               << "    RET\n"
+               << "recurse:\n"
+               << "    PUSH_LOCAL 0\n"
+               << "    PUSH_CONST 1\n"
+               << "    SUB\n"
+               << "    CALL 0\n"
+               << "    PUSH_LOCAL 0\n"
+               << "    PUSH_CONST 2\n"
+               << "    SUB\n"
+               << "    CALL 0\n"
+               << "    ADD\n"
+               << "    RET\n"
+               << ".end\n";
+        write_epilogue(source, parameters);
+    }
+
+    void array_fill(std::ostream &source, const workload::Parameters &parameters)
+    {
+        long n = parameter(parameters, "n", 10000);
+        write_prologue(source, "array_fill", n);
+        source << "\n.function run 1 array 2\n"
+               << "    STORE_LOCAL 0\n"
+               << "    NEW_ARRAY " << n << " i32\n"
+               << "    STORE_LOCAL 2\n";
+        write_loop(source, 1, 0,
+                   "    PUSH_LOCAL 2\n"
+                   "    PUSH_LOCAL 1\n"
+                   "    PUSH_LOCAL 1\n"
+                   "    SET_ARRAY\n");
+        source << "    PUSH_LOCAL 2\n"
+               << "    RET\n"
+               << ".end\n";
+        write_epilogue(source, parameters);
+    }
+
+    void string_concat(std::ostream &source, const workload::Parameters &parameters)
+    {
+        write_prologue(source, "string_concat", parameter(parameters, "n", 1000));
+        source << ".const string \"\"\n"
+               << ".const string \"snail\"\n"
+               << "\n.function run 1 string 2\n"
+               << "    STORE_LOCAL 0\n"
+               << "    PUSH_CONST 4\n"
+               << "    STORE_LOCAL 2\n";
+        write_loop(source, 1, 0,
+                   "    PUSH_LOCAL 2\n"
+                   "    PUSH_CONST 5\n"
+                   "    ADD\n"
+                   "    STORE_LOCAL 2\n");
+        source << "    PUSH_LOCAL 2\n"
+               << "    RET\n"
+               << ".end\n";
+        write_epilogue(source, parameters);
+    }
+
+    // run(n) sums level_1(i) for i < n, every level adds one and calls the next, down to depth
+    void call_depth(std::ostream &source, const workload::Parameters &parameters)
+    {
+        long depth = std::max(parameter(parameters, "depth", 16), 1L);
+        write_prologue(source, "call_depth", parameter(parameters, "n", 1000));
+        source << "\n.function run 1 i32 2\n"
+               << "    STORE_LOCAL 0\n"
+               << "    PUSH_CONST 0\n"
+               << "    STORE_LOCAL 2\n";
+        write_loop(source, 1, 0,
+                   "    PUSH_LOCAL 2\n"
+                   "    PUSH_LOCAL 1\n"
+                   "    CALL 1\n"
+                   "    ADD\n"
+                   "    STORE_LOCAL 2\n");
+        source << "    PUSH_LOCAL 2\n"
+               << "    RET\n"
+               << ".end\n";
+        for (long level = 1; level <= depth; ++level)
+        {
+            source << "\n.function level_" << level << " 1 i32 0\n"
+                   << "    STORE_LOCAL 0\n"
+                   << "    PUSH_LOCAL 0\n"
+                   << "    PUSH_CONST 1\n"
+                   << "    ADD\n";
+            if (level < depth)
+                source << "    CALL " << level + 1 << "\n";
+            source << "    RET\n"
+                   << ".end\n";
+        }
+        write_epilogue(source, parameters);
+    }
+
+    using generator = void (*)(std::ostream &, const workload::Parameters &);
+
+    const std::vector<std::pair<std::string, generator>> &generators()
+    {
+        static const std::vector<std::pair<std::string, generator>> table = {
+            {"sum_loop", sum_loop},
+            {"fibonacci", fibonacci},
+            {"array_fill", array_fill},
+            {"string_concat", string_concat},
+            {"call_depth", call_depth},
+        };
+        return table;
+    }
+}
+
+std::vector<std::string> workload::names()
+{
+    std::vector<std::string> result;
+    for (const auto &[name, _] : generators())
+        result.push_back(name);
+    return result;
+}
+
+std::string workload::generate(const std::string &name, const Parameters &parameters)
+{
+    for (const auto &[candidate, write] : generators())
+    {
+        if (candidate == name)
+        {
+            std::ostringstream source;
+            write(source, parameters);
+            return source.str();
+        }
+    }
+    throw std::invalid_argument("Unknown workload " + name);
+}
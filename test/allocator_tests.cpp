@@ -60,4 +60,17 @@ TEST_F(AllocatorTestFixture, garbageTest)
     objects[5]->links = 0;
     create_with_links(allocator, 2);
     EXPECT_EQ(16, allocator.size());
-}
\ No newline at end of file
+}
+TEST_F(AllocatorTestFixture, siteTest)
+{
+    allocator.site = 0x10;
+    create(allocator);
+    allocator.track_sites(true);
+    create(allocator, 2);
+    allocator.site = 0x20;
+    Object *array = allocator.create(Type::ARRAY, nullptr, 3);
+
+    EXPECT_EQ(0x20U, array->site) << "Objects should be stamped with the current site!";
+    EXPECT_EQ(2U, allocator.site_counters().at(0x10).allocations) << "Only allocations made while tracking should be counted!";
+    EXPECT_EQ(vm::heap::footprint(*array), allocator.site_counters().at(0x20).bytes) << "Bytes of a site should include the array elements!";
+}
@@ -0,0 +1,452 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm::runtime;
+
+static vm::Environment empty_environment()
+{
+    return vm::Environment(vm::load_image(vm::code::assemble(".body\n.end\n")));
+}
+
+static Object *push(vm::Environment &env, Object *object)
+{
+    object->links++;
+    env.stack.push(object);
+    return object;
+}
+
+static Object *push_number(vm::Environment &env, Type type, u32 value)
+{
+    return push(env, env.allocator.create(type, reinterpret_cast<const byte *>(&value), sizeof(value)));
+}
+
+static Object *pop(vm::Environment &env)
+{
+    Object *top = env.stack.top();
+    top->links--;
+    env.stack.pop();
+    return top;
+}
+
+// Sizes around the vector widths, so the kernels run their tails too
+static const std::size_t SIZES[] = {1, 3, 4, 7, 8, 9, 31, 1000, 1027};
+
+TEST(ArraysTests, kernelsTest)
+{
+    vm::Environment env = empty_environment();
+    for (std::size_t size : SIZES)
+    {
+        Object *numbers = env.allocator.create_array(size, Type::I32);
+        numbers->links++;
+        int *values = reinterpret_cast<int *>(numbers->data);
+        int sum = 0;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            values[i] = static_cast<int>(i * 7 % 23) - 11;
+            sum += values[i];
+        }
+        values[size / 2] = -40;
+        values[size - 1] = 50;
+        sum += -40 - static_cast<int>((size / 2) * 7 % 23) + 11;
+        sum += size == 1 ? 40 + 50 : 50 - static_cast<int>((size - 1) * 7 % 23) + 11;
+
+        push(env, numbers);
+        ASSERT_TRUE(vm::arrays::call("array_sum", env));
+        EXPECT_EQ(sum, static_cast<int>(*pop(env))) << "size " << size;
+        push(env, numbers);
+        vm::arrays::call("array_min", env);
+        EXPECT_EQ(size == 1 ? 50 : -40, static_cast<int>(*pop(env))) << "size " << size;
+        push(env, numbers);
+        vm::arrays::call("array_max", env);
+        EXPECT_EQ(50, static_cast<int>(*pop(env))) << "size " << size;
+        push(env, numbers);
+        push_number(env, Type::I32, 50);
+        vm::arrays::call("array_index_of", env);
+        EXPECT_EQ(static_cast<int>(size - 1), static_cast<int>(*pop(env))) << "size " << size;
+        push(env, numbers);
+        push_number(env, Type::I32, 12345);
+        vm::arrays::call("array_index_of", env);
+        EXPECT_EQ(-1, static_cast<int>(*pop(env))) << "size " << size;
+
+        push(env, numbers);
+        push_number(env, Type::I32, 9);
+        vm::arrays::call("array_fill", env);
+        EXPECT_TRUE(env.stack.empty());
+        for (std::size_t i = 0; i < size; ++i)
+            ASSERT_EQ(9, values[i]) << "size " << size;
+        numbers->links--;
+    }
+}
+
+TEST(ArraysTests, unsignedTest)
+{
+    vm::Environment env = empty_environment();
+    Object *numbers = env.allocator.create_array(11, Type::USIZE);
+    numbers->links++;
+    u32 *values = reinterpret_cast<u32 *>(numbers->data);
+    for (u32 i = 0; i < 11; ++i)
+        values[i] = 0x80000000U + i;
+    values[4] = 3;
+
+    push(env, numbers);
+    vm::arrays::call("array_min", env);
+    Object *min = pop(env);
+    EXPECT_EQ(Type::USIZE, min->type);
+    EXPECT_EQ(3, static_cast<u32>(*min)) << "usize elements should compare unsigned!";
+    push(env, numbers);
+    vm::arrays::call("array_max", env);
+    EXPECT_EQ(0x8000000AU, static_cast<u32>(*pop(env)));
+    numbers->links--;
+}
+
+TEST(ArraysTests, intrinsicsTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const i32 1
+        .const i32 2
+        .const i32 5
+        .const i32 0
+        .const string "snail"
+        .global numbers array i32 10
+        .global copy array i32 10
+        .intrinsic println 1 void
+        .intrinsic array_fill 2 void
+        .intrinsic array_copy 5 void
+        .intrinsic array_equals 2 i32
+        .intrinsic array_length 1 usize
+        .intrinsic array_index_of 2 i32
+        .body
+            NEW_ARRAY 10 i32
+            STORE_GLOBAL 0
+            NEW_ARRAY 10 i32
+            STORE_GLOBAL 1
+            PUSH_GLOBAL 0
+            PUSH_CONST 2
+            INTRINSIC_CALL 1
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            PUSH_CONST 3
+            SET_ARRAY
+            PUSH_GLOBAL 1
+            PUSH_CONST 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 0
+            PUSH_CONST 2
+            INTRINSIC_CALL 2
+            PUSH_GLOBAL 1
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_GLOBAL 1
+            INTRINSIC_CALL 3
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            PUSH_GLOBAL 1
+            PUSH_CONST 0
+            PUSH_CONST 2
+            INTRINSIC_CALL 2
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 4
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 4
+            PUSH_CONST 3
+            SET_ARRAY
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 4
+            INTRINSIC_CALL 5
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("[0, 5, 5, 5, 5, 5, 0, 0, 0, 0]\n"
+              "0\n"
+              "10\n"
+              "[snail, 5, 5, 5, 5, 5, 5, 5, 5, 5]\n"
+              "0\n",
+              output.str());
+}
+
+TEST(ArraysTests, elementTypesTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const i32 0
+        .const i32 1
+        .const i32 2
+        .const i32 3
+        .const usize 3000000000
+        .intrinsic println 1 void
+        .intrinsic array_equals 2 i32
+        .intrinsic array_fill 2 void
+        .body
+            NEW_ARRAY 1 array
+            DUP
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 2
+            PUSH_CONST 1
+            SET_ARRAY
+            PUSH_CONST 0
+            SET_ARRAY
+            DUP
+            NEW_ARRAY 1 array
+            DUP
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 3
+            PUSH_CONST 1
+            SET_ARRAY
+            PUSH_CONST 0
+            SET_ARRAY
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+            NEW_ARRAY 1 array
+            DUP
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 2
+            PUSH_CONST 1
+            SET_ARRAY
+            PUSH_CONST 0
+            SET_ARRAY
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+            NEW_ARRAY 1 i32
+            DUP
+            PUSH_CONST 4
+            PUSH_CONST 0
+            SET_ARRAY
+            INTRINSIC_CALL 0
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 4
+            INTRINSIC_CALL 2
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("0\n"
+              "1\n"
+              "[3000000000]\n"
+              "[3000000000, 3000000000]\n",
+              output.str());
+
+    vm::Environment empty = empty_environment();
+    Object *numbers = push(empty, empty.allocator.create_array(2, Type::I32));
+    Object *sizes = push(empty, empty.allocator.create_array(2, Type::USIZE));
+    EXPECT_NE(*numbers, *sizes) << "Typed arrays of different element types should not be equal!";
+    reinterpret_cast<u32 *>(sizes->data)[1] = 7;
+    Object *boxed = push(empty, empty.allocator.create_array(2, Type::VOID));
+    for (u32 i = 0; i < 2; ++i)
+    {
+        Object *element = push_number(empty, Type::USIZE, i == 1 ? 7 : 0);
+        reinterpret_cast<Link *>(boxed->data)[i] = element;
+    }
+    EXPECT_EQ(*sizes, *boxed) << "Boxed elements should equal the raw elements of their type!";
+}
+
+static int search(vm::Environment &env, Object *array, Type type, u32 value)
+{
+    push(env, array);
+    push_number(env, type, value);
+    vm::arrays::call("array_binary_search", env);
+    return static_cast<int>(*pop(env));
+}
+
+TEST(ArraysTests, sortTest)
+{
+    vm::Environment env = empty_environment();
+    std::mt19937 random(7);
+    // Below and above the size where sorting switches to radix sort
+    for (std::size_t size : {9, 100, 5000})
+    {
+        Object *numbers = env.allocator.create_array(size, Type::I32);
+        numbers->links++;
+        int *values = reinterpret_cast<int *>(numbers->data);
+        for (std::size_t i = 0; i < size; ++i)
+            values[i] = static_cast<int>(random() % 2001) - 1000;
+        values[0] = -2000000000;
+        std::vector<int> expected(values, values + size);
+        std::sort(expected.begin(), expected.end());
+
+        push(env, numbers);
+        vm::arrays::call("array_sort", env);
+        ASSERT_TRUE(std::equal(expected.begin(), expected.end(), values)) << "size " << size;
+        EXPECT_EQ(0, search(env, numbers, Type::I32, static_cast<u32>(-2000000000)));
+        int found = search(env, numbers, Type::I32, static_cast<u32>(values[size / 2]));
+        EXPECT_EQ(values[size / 2], values[found]);
+        EXPECT_EQ(-static_cast<int>(size) - 1, search(env, numbers, Type::I32, 5000)) << "Missing values should give the insertion point!";
+        numbers->links--;
+    }
+}
+
+TEST(ArraysTests, sortLinksTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const string "snail"
+        .const string "shell"
+        .const string "slime"
+        .const string "sn"
+        .const i32 -3
+        .const usize 7
+        .intrinsic println 1 void
+        .intrinsic array_sort 1 void
+        .intrinsic array_binary_search 2 i32
+        .body
+            NEW_ARRAY 4 string
+            PUSH_CONST 3
+            PUSH_CONST 2
+            PUSH_CONST 1
+            PUSH_CONST 0
+            INIT_ARRAY 4
+            DUP
+            DUP
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+            PUSH_CONST 0
+            INTRINSIC_CALL 2
+            INTRINSIC_CALL 0
+            NEW_ARRAY 3 void
+            PUSH_CONST 5
+            PUSH_CONST 0
+            PUSH_CONST 4
+            INIT_ARRAY 3
+            DUP
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("[shell, slime, sn, snail]\n3\n[-3, 7, snail]\n", output.str());
+}
+
+TEST(ArraysTests, sortArraysTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const i32 1
+        .const i32 2
+        .const i32 5
+        .const i32 0
+        .intrinsic println 1 void
+        .intrinsic array_sort 1 void
+        .intrinsic array_binary_search 2 i32
+        .body
+            NEW_ARRAY 4 array
+            NEW_ARRAY 1 i32
+            DUP
+            PUSH_CONST 0
+            PUSH_CONST 3
+            SET_ARRAY
+            NEW_ARRAY 0 i32
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 0
+            PUSH_CONST 3
+            SET_ARRAY
+            DUP
+            PUSH_CONST 2
+            PUSH_CONST 0
+            SET_ARRAY
+            NEW_ARRAY 1 i32
+            DUP
+            PUSH_CONST 1
+            PUSH_CONST 3
+            SET_ARRAY
+            INIT_ARRAY 4
+            DUP
+            INTRINSIC_CALL 0
+            DUP
+            DUP
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+            NEW_ARRAY 2 i32
+            DUP
+            PUSH_CONST 0
+            PUSH_CONST 3
+            SET_ARRAY
+            DUP
+            PUSH_CONST 2
+            PUSH_CONST 0
+            SET_ARRAY
+            INTRINSIC_CALL 2
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("[[2], [1, 5], [], [1]]\n[[], [1], [1, 5], [2]]\n2\n", output.str()) << "Arrays should be ordered element by element!";
+
+    vm::Environment maps(vm::load_image(vm::code::assemble(R"(
+        .intrinsic array_sort 1 void
+        .intrinsic map_new 0 map
+        .body
+            NEW_ARRAY 2 void
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 1
+            INIT_ARRAY 2
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    EXPECT_THROW(vm::run(maps, false), vm::code::InvalidBytecodeException) << "Maps have no order to sort by!";
+}
+
+TEST(ArraysTests, boundsTest)
+{
+    vm::Environment env = empty_environment();
+    Object *numbers = push(env, env.allocator.create_array(4, Type::I32));
+    push_number(env, Type::I32, 2);
+    push(env, numbers);
+    push_number(env, Type::I32, 0);
+    push_number(env, Type::I32, 3);
+    EXPECT_THROW(vm::arrays::call("array_copy", env), vm::code::InvalidBytecodeException);
+    EXPECT_TRUE(env.stack.empty());
+    EXPECT_FALSE(vm::arrays::call("array_unknown", env));
+}
+
+TEST(ArraysTests, checkedAccessTest)
+{
+    const char *program = R"(
+        .const i32 %d
+        .body
+            NEW_ARRAY 3 %s
+            PUSH_CONST 0
+            GET_ARRAY
+            POP
+        .end
+    )";
+    char source[256];
+    for (int index : {3, -1})
+    {
+        std::snprintf(source, sizeof(source), program, index, "i32");
+        vm::Environment env(vm::load_image(vm::code::assemble(source)));
+        EXPECT_THROW(vm::run(env, false), vm::code::InvalidBytecodeException) << "index " << index;
+    }
+    std::snprintf(source, sizeof(source), program, 1, "string");
+    vm::Environment env(vm::load_image(vm::code::assemble(source)));
+    EXPECT_THROW(vm::run(env, false), vm::code::InvalidBytecodeException) << "Reading an empty element should stop the program!";
+
+    vm::Environment empty = empty_environment();
+    Object *numbers = push(empty, empty.allocator.create_array(10, Type::I32));
+    Object *index = push_number(empty, Type::I32, 0);
+    Object *bound = push_number(empty, Type::I32, 10);
+    Object *step = push_number(empty, Type::I32, 1);
+    EXPECT_TRUE(vm::proccess::loop_in_bounds(numbers, index, bound, step));
+    Object *beyond = push_number(empty, Type::I32, 11);
+    EXPECT_FALSE(vm::proccess::loop_in_bounds(numbers, index, beyond, step));
+    Object *negative = push_number(empty, Type::I32, static_cast<u32>(-1));
+    EXPECT_FALSE(vm::proccess::loop_in_bounds(numbers, negative, bound, step));
+    EXPECT_FALSE(vm::proccess::loop_in_bounds(numbers, index, bound, negative)) << "A loop that counts down may leave the array!";
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm::code;
+using namespace vm::runtime;
+
+static fs::path write_file(const std::string &name, const std::vector<byte> &bytes)
+{
+    fs::path path = fs::temp_directory_path() / ("shellvm_assembler_" + name + ".slime");
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    return path;
+}
+
+TEST(AssemblerTests, roundTripTest)
+{
+    std::string source = vm::workload::generate("string_concat", {}) + R"(
+        .global counter i32
+        .global data array i32 5
+    )";
+    std::vector<byte> bytes = assemble(source);
+    Reader reader(write_file("round_trip", bytes));
+    std::stringstream text;
+    disassemble(reader, text);
+
+    EXPECT_EQ(bytes, assemble(text.str())) << "Disassembled program should assemble to the same bytes!";
+}
+
+TEST(AssemblerTests, labelTest)
+{
+    std::vector<byte> bytes = assemble(R"(
+        .const string "a \"b\"\n"
+        .intrinsic println 1 void
+        .body
+        top: PUSH_CONST 0
+            JMP_IF_TRUE end
+            JMP top        ; backwards
+        end:
+            NEW_ARRAY 3 i32
+        .end
+    )");
+    std::vector<byte> body(bytes.end() - 19, bytes.end());
+    std::vector<byte> expected = {0x00, 0x00, 0x00, 0x0F,
+                                  Command::PUSH_CONST, 0x00, 0x00,
+                                  Command::JMP_IF_TRUE, 0x00, 0x03,
+                                  Command::JMP, 0xFF, 0xF7,
+                                  Command::NEW_ARRAY, 0x00, 0x00, 0x00, 0x03, Type::I32};
+    EXPECT_EQ(expected, body) << "Labels should resolve relative to the end of the jump!";
+
+    Reader reader(write_file("labels", bytes));
+    reader.read_header();
+    ConstantPool constants = reader.read_constants();
+    EXPECT_EQ("a \"b\"\n", static_cast<std::string>(*constants.data[0])) << "String escapes should be decoded!";
+}
+
+TEST(AssemblerTests, errorTest)
+{
+    EXPECT_THROW(assemble(".body\nJMP nowhere\n.end\n"), InvalidBytecodeException);
+    EXPECT_THROW(assemble(".body\nPUSH_CONST\n.end\n"), InvalidBytecodeException);
+    EXPECT_THROW(assemble(".body\nFLY 1\n.end\n"), InvalidBytecodeException);
+    EXPECT_THROW(assemble(".const i32 1\n"), InvalidBytecodeException);
+}
+
+static int run_workload(const std::string &name, const vm::workload::Parameters &parameters)
+{
+    Reader reader(write_file(name, assemble(vm::workload::generate(name, parameters))));
+    vm::memory::Allocator allocator;
+    vm::Environment env = vm::load(reader, allocator);
+    env.jit_threshold = std::numeric_limits<std::size_t>::max();
+    u32 length = reader.read_32();
+    vm::process(reader, env, length, 0, false);
+    return static_cast<int>(*env.stack.top());
+}
+
+TEST(AssemblerTests, workloadTest)
+{
+    EXPECT_EQ(4950, run_workload("sum_loop", {{"n", 100}}));
+    EXPECT_EQ(55, run_workload("fibonacci", {{"n", 10}}));
+    EXPECT_EQ(100 * 99 / 2 + 100 * 8, run_workload("call_depth", {{"n", 100}, {"depth", 8}}));
+    EXPECT_THROW(vm::workload::generate("unknown", {}), std::invalid_argument);
+}
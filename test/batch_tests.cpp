@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static fs::path write_program(const std::string &name, const std::string &workload, long n)
+{
+    std::vector<byte> bytes = code::assemble(workload::generate(workload, {{"n", n}, {"print", 1}}));
+    fs::path path = fs::temp_directory_path() / ("shellvm_batch_" + name + ".slime");
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    return path;
+}
+
+TEST(BatchTests, jobsFileTest)
+{
+    fs::path jobs = fs::temp_directory_path() / "shellvm_batch_jobs.txt";
+    std::ofstream(jobs, std::ios::trunc) << "# comment\nfirst.slime\n\n  /absolute.slime  \n";
+    std::vector<fs::path> files = batch::read_jobs(jobs);
+    ASSERT_EQ(2U, files.size());
+    EXPECT_EQ(fs::temp_directory_path() / "first.slime", files[0]);
+    EXPECT_EQ(fs::path("/absolute.slime"), files[1]);
+}
+
+TEST(BatchTests, runTest)
+{
+    fs::path sum = write_program("sum", "sum_loop", 100);
+    fs::path fib = write_program("fib", "fibonacci", 6);
+    std::vector<fs::path> files;
+    for (int i = 0; i < 8; ++i)
+        files.push_back(i % 2 == 0 ? sum : fib);
+    files.push_back(fs::temp_directory_path() / "shellvm_batch_missing.slime");
+
+    batch::Summary summary = batch::run(files, 3, false);
+    ASSERT_EQ(files.size(), summary.jobs.size());
+    for (int i = 0; i < 8; ++i)
+    {
+        EXPECT_EQ(i % 2 == 0 ? "4950\n" : "8\n", summary.jobs[i].output) << "Every job should capture its own output!";
+        EXPECT_TRUE(summary.jobs[i].error.empty());
+    }
+    EXPECT_FALSE(summary.jobs.back().error.empty()) << "A failing job should not stop the batch!";
+    EXPECT_EQ(2U, summary.images_loaded);
+    EXPECT_EQ(6U, summary.image_cache_hits);
+
+    std::stringstream output, errors;
+    batch::write_outputs(output, errors, summary);
+    EXPECT_EQ("4950\n8\n4950\n8\n4950\n8\n4950\n8\n", output.str());
+    EXPECT_NE(std::string::npos, errors.str().find("shellvm_batch_missing.slime"));
+}
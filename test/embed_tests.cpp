@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <limits>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static const char *SCRIPT = R"(
+    .const i32 1
+    .const string "Hello, "
+    .global counter i32
+
+    .function sub 2 i32 0
+        STORE_LOCAL 1
+        STORE_LOCAL 0
+        PUSH_LOCAL 0
+        PUSH_LOCAL 1
+        SUB
+        RET
+    .end
+
+    .function greet 1 string 0
+        STORE_LOCAL 0
+        PUSH_CONST 1
+        PUSH_LOCAL 0
+        ADD
+        RET
+    .end
+
+    .function bump 0 i32 0
+        PUSH_GLOBAL 0
+        PUSH_CONST 0
+        ADD
+        STORE_GLOBAL 0
+        PUSH_GLOBAL 0
+        RET
+    .end
+
+    .body
+        PUSH_CONST 0
+        STORE_GLOBAL 0
+    .end
+)";
+
+TEST(EmbedTests, callTest)
+{
+    embed::Instance instance(load_image(code::assemble(SCRIPT)));
+    instance.environment().jit_threshold = std::numeric_limits<std::size_t>::max();
+    EXPECT_EQ(1, instance.function("greet"));
+    EXPECT_THROW(instance.function("missing"), std::out_of_range);
+
+    u16 sub = instance.function("sub");
+    for (int i = 0; i < 1000; ++i)
+        ASSERT_EQ(embed::Value(i - 3), instance.call(sub, {i, 3})) << "Arguments should keep their order!";
+    EXPECT_EQ(embed::Value(std::string("Hello, snail")), instance.call("greet", {std::string("snail")}));
+    EXPECT_THROW(instance.call(sub, {1}), std::invalid_argument);
+    EXPECT_TRUE(instance.environment().stack.empty()) << "Calls should leave the stack as they found it!";
+}
+
+TEST(EmbedTests, globalsTest)
+{
+    embed::Instance instance(load_image(code::assemble(SCRIPT)));
+    instance.run_main();
+    EXPECT_EQ(embed::Value(2), instance.call("bump"));
+    EXPECT_EQ(embed::Value(3), instance.call("bump")) << "Globals should persist between calls!";
+}
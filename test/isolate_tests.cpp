@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+#include <limits>
+#include <thread>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static std::shared_ptr<Image> fibonacci_image(long n)
+{
+    return load_image(code::assemble(workload::generate("fibonacci", {{"n", n}})));
+}
+
+TEST(IsolateTests, imageTest)
+{
+    std::shared_ptr<Image> image = fibonacci_image(10);
+    ASSERT_EQ(1, image->functions.size);
+    EXPECT_EQ("fib", image->functions.functions[0].name);
+
+    code::Reader first = image->reader(), second = image->reader();
+    first.set_offset(image->body_offset);
+    EXPECT_EQ(0U, second.get_offset()) << "Readers of an image should be independent cursors!";
+    EXPECT_EQ(0x534E4131U, second.read_32());
+    EXPECT_EQ(image->body_offset, first.get_offset());
+
+    Environment env(image);
+    EXPECT_NE(image->constant_pool.data[0], env.constant_pool.data[0]) << "Constants should be copied per isolate!";
+    EXPECT_EQ(&image->functions, &env.functions);
+}
+
+TEST(IsolateTests, concurrentTest)
+{
+    std::shared_ptr<Image> image = fibonacci_image(15);
+    constexpr std::size_t ISOLATES = 4;
+    int results[ISOLATES] = {};
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < ISOLATES; ++i)
+    {
+        threads.emplace_back([&image, &results, i]
+                             {
+                                 Environment env(image);
+                                 env.jit_threshold = std::numeric_limits<std::size_t>::max();
+                                 run(env, false);
+                                 results[i] = static_cast<int>(*env.stack.top()); });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    for (int result : results)
+        EXPECT_EQ(610, result);
+}
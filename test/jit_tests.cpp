@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static const char *PROGRAM = R"(
+    .function hot 0 void 0
+        CALL 1
+        CALL 3
+        RET
+    .end
+
+    .function callee 0 void 0
+        CALL 2
+        RET
+    .end
+
+    .function nested 0 void 0
+        RET
+    .end
+
+    .function never_run 0 void 0
+        RET
+    .end
+
+    .function warm 0 void 0
+        RET
+    .end
+
+    .function cold 0 void 0
+        RET
+    .end
+
+    .body
+        CALL 0
+    .end
+)";
+
+TEST(JitTests, selectBatchTest)
+{
+    Environment env(load_image(code::assemble(PROGRAM)));
+    code::Reader reader = env.image->reader();
+    env.jit_threshold = 100;
+    env.calls = {101, 101, 1, 0, 60, 10};
+
+    std::vector<u16> batch = jit::select_batch(env, reader, 0, false);
+    std::sort(batch.begin(), batch.end());
+    EXPECT_EQ((std::vector<u16>{0, 1, 2, 4}), batch) << "Callees that ran and warm functions should join the hot one!";
+
+    env.functions.functions[1].compiled.store(reinterpret_cast<void *>(1));
+    batch = jit::select_batch(env, reader, 0, false);
+    std::sort(batch.begin(), batch.end());
+    EXPECT_EQ((std::vector<u16>{0, 4}), batch) << "Compiled functions should not be compiled again!";
+    env.functions.functions[1].compiled.store(nullptr);
+}
+
+TEST(JitTests, batchLimitTest)
+{
+    std::string source;
+    for (std::size_t i = 0; i < 2 * jit::BATCH_LIMIT; ++i)
+        source += ".function f" + std::to_string(i) + " 0 void 0\n RET\n.end\n";
+    source += ".body\n.end\n";
+    Environment env(load_image(code::assemble(source)));
+    code::Reader reader = env.image->reader();
+    std::fill(env.calls.begin(), env.calls.end(), env.jit_threshold);
+
+    std::vector<u16> batch = jit::select_batch(env, reader, 5, false);
+    EXPECT_EQ(jit::BATCH_LIMIT, batch.size());
+    EXPECT_EQ(5, batch.front()) << "The hot function should always be compiled!";
+}
+
+static const char *LOOPS = R"(
+    .const i32 0
+    .const i32 1
+    .intrinsic array_length 1 usize
+
+    .function fill 2 void 1
+        STORE_LOCAL 1
+        STORE_LOCAL 0
+        PUSH_CONST 0
+        STORE_LOCAL 2
+    loop:
+        PUSH_LOCAL 2
+        PUSH_LOCAL 1
+        LT
+        JMP_IF_FALSE done
+        PUSH_LOCAL 0
+        PUSH_LOCAL 2
+        PUSH_LOCAL 2
+        SET_ARRAY
+        PUSH_LOCAL 2
+        PUSH_CONST 1
+        ADD
+        STORE_LOCAL 2
+        JMP loop
+    done:
+        RET
+    .end
+
+    .function shifted 1 void 1
+        STORE_LOCAL 0
+        PUSH_CONST 0
+        STORE_LOCAL 1
+    loop:
+        PUSH_LOCAL 1
+        PUSH_LOCAL 0
+        INTRINSIC_CALL 0
+        LT
+        JMP_IF_FALSE done
+        PUSH_LOCAL 0
+        PUSH_LOCAL 1
+        GET_ARRAY
+        POP
+        PUSH_LOCAL 1
+        PUSH_CONST 1
+        ADD
+        STORE_LOCAL 1
+        PUSH_LOCAL 0
+        PUSH_LOCAL 1
+        GET_ARRAY
+        POP
+        JMP loop
+    done:
+        RET
+    .end
+
+    .body
+    .end
+)";
+
+TEST(JitTests, rangeAnalysisTest)
+{
+    std::shared_ptr<Image> image = load_image(code::assemble(LOOPS));
+    code::Reader reader = image->reader();
+    const code::Function &fill = image->functions.functions[0];
+    reader.set_offset(fill.offset);
+    ranges::Analysis analysis = ranges::analyze(reader, fill.length);
+    ASSERT_EQ(1, analysis.loops.size());
+    EXPECT_EQ(2, analysis.loops[0].index);
+    EXPECT_EQ(0, analysis.loops[0].array);
+    EXPECT_EQ(code::Command::PUSH_LOCAL, analysis.loops[0].bound_command);
+    EXPECT_EQ(1, analysis.loops[0].step);
+    EXPECT_EQ(1, analysis.accesses.size()) << "The SET_ARRAY of the loop should need no checks!";
+
+    const code::Function &shifted = image->functions.functions[1];
+    reader.set_offset(shifted.offset);
+    analysis = ranges::analyze(reader, shifted.length);
+    ASSERT_EQ(1, analysis.loops.size());
+    EXPECT_EQ(code::Command::INTRINSIC_CALL, analysis.loops[0].bound_command);
+    ASSERT_EQ(1, analysis.accesses.size()) << "Only the access before the increment should be proven in bounds!";
+    // Three instructions before the loop, five in its header and two pushes
+    EXPECT_EQ(shifted.offset + 28, analysis.accesses.begin()->first);
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+#include "vm.hpp"
+
+using namespace vm::runtime;
+
+static Object *create_number(vm::memory::Allocator &allocator, u32 value)
+{
+    return allocator.create(Type::I32, reinterpret_cast<const byte *>(&value), sizeof(value));
+}
+
+TEST(MapsTests, putRemoveTest)
+{
+    vm::memory::Allocator allocator;
+    // Keys are not linked while their values are created, so nothing may be collected
+    allocator.reserve(50000);
+    Map map;
+    std::unordered_map<u32, Object *> expected;
+    std::mt19937 random(3);
+    // Few distinct keys, so removed slots are reused and the map rehashes over its tombstones
+    for (int i = 0; i < 20000; ++i)
+    {
+        u32 value = random() % 700;
+        Object *key = create_number(allocator, value);
+        if (random() % 3 == 0)
+        {
+            EXPECT_EQ(expected.erase(value) == 1, map.remove(key));
+        }
+        else
+        {
+            Object *stored = create_number(allocator, value * 2);
+            map.put(key, stored);
+            expected[value] = stored;
+        }
+        ASSERT_EQ(expected.size(), map.size());
+    }
+    for (u32 value = 0; value < 700; ++value)
+    {
+        Object *key = create_number(allocator, value);
+        auto found = expected.find(value);
+        EXPECT_EQ(found == expected.end() ? nullptr : found->second, map.find(key)) << "key " << value;
+    }
+    std::size_t visited = 0;
+    for (std::size_t slot = map.next(0); slot < map.slots(); slot = map.next(slot + 1))
+        ++visited;
+    EXPECT_EQ(map.size(), visited);
+}
+
+TEST(MapsTests, keysTest)
+{
+    vm::memory::Allocator allocator;
+    allocator.reserve(16);
+    Map map;
+    const char text[] = "snail";
+    Object *string = allocator.create(Type::STRING, reinterpret_cast<const byte *>(text), 5);
+    Object *same = allocator.create(Type::STRING, reinterpret_cast<const byte *>(text), 5);
+    Object *number = create_number(allocator, 5);
+    u32 five = 5;
+    Object *unsigned_number = allocator.create(Type::USIZE, reinterpret_cast<const byte *>(&five), sizeof(five));
+    Object *array = allocator.create_array(2, Type::VOID);
+    Object *equal_array = allocator.create_array(2, Type::VOID);
+
+    map.put(string, number);
+    map.put(number, string);
+    map.put(array, number);
+    EXPECT_EQ(number, map.find(same)) << "Strings should be keys by value!";
+    EXPECT_EQ(nullptr, map.find(unsigned_number)) << "i32 and usize keys should differ!";
+    EXPECT_EQ(nullptr, map.find(equal_array)) << "Arrays should be keys by identity!";
+    EXPECT_EQ(3, number->links);
+    EXPECT_TRUE(map.remove(same));
+    EXPECT_EQ(2, number->links);
+    EXPECT_EQ(0, string->links + same->links - 1) << "The map should release removed keys!";
+}
+
+TEST(MapsTests, intrinsicsTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const string "snail"
+        .const string "shell"
+        .const i32 1
+        .const i32 2
+        .const string "sn"
+        .const string "ail"
+        .global counts map
+        .intrinsic println 1 void
+        .intrinsic map_new 0 map
+        .intrinsic map_put 3 void
+        .intrinsic map_get 2 void
+        .intrinsic map_contains 2 i32
+        .intrinsic map_remove 2 i32
+        .intrinsic map_size 1 usize
+        .intrinsic map_get_or 3 void
+        .body
+            INTRINSIC_CALL 1
+            STORE_GLOBAL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 0
+            PUSH_CONST 2
+            INTRINSIC_CALL 2
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            PUSH_CONST 3
+            INTRINSIC_CALL 2
+            PUSH_GLOBAL 0
+            PUSH_CONST 4
+            PUSH_CONST 5
+            ADD
+            PUSH_CONST 3
+            INTRINSIC_CALL 2
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 6
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 0
+            INTRINSIC_CALL 3
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            INTRINSIC_CALL 5
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            INTRINSIC_CALL 4
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            PUSH_CONST 2
+            INTRINSIC_CALL 7
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("2\n2\n1\n0\n1\n{snail: 2}\n", output.str()) << "Concatenated strings should find constant keys!";
+}
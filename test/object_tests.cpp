@@ -2,6 +2,9 @@
 #include <fstream>
 #include <bitset>
 #include <iostream>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "vm.hpp"
 
@@ -50,4 +53,206 @@ TEST(ObjectTests, operatorsTest)
     EXPECT_TRUE(big > small);
     EXPECT_FALSE(small >= big);
     EXPECT_TRUE(big >= small);
-}
\ No newline at end of file
+}
+
+static Object create_string(const std::string &value)
+{
+    return {Type::STRING, reinterpret_cast<const byte *>(value.data()), value.size()};
+}
+
+TEST(ObjectTests, formatTest)
+{
+    std::string buffer = "> ";
+    create_int(-105676).format(buffer);
+    buffer.push_back(' ');
+    create_string("snail").format(buffer);
+    EXPECT_EQ("> -105676 snail", buffer);
+    EXPECT_EQ("2147483647", static_cast<std::string>(create_int(2147483647)));
+}
+
+TEST(ObjectTests, formatArrayTest)
+{
+    Object inner(Type::ARRAY, nullptr, 2);
+    Object outer(Type::ARRAY, nullptr, 3);
+    Object first = create_int(1);
+    Object second = create_int(2);
+    Object *element = &first;
+    reinterpret_cast<Link *>(inner.data)[0] = element;
+    element = &second;
+    reinterpret_cast<Link *>(inner.data)[1] = element;
+    element = &inner;
+    reinterpret_cast<Link *>(outer.data)[0] = element;
+    element = &first;
+    reinterpret_cast<Link *>(outer.data)[1] = element;
+    EXPECT_EQ("[[1, 2], 1, ...]", static_cast<std::string>(outer));
+}
+
+TEST(ObjectTests, appendTest)
+{
+    Object builder(Type::STRING, reinterpret_cast<const byte *>("snail"), 5, true);
+    EXPECT_EQ(16, builder.capacity());
+    std::string expected = "snail";
+    for (int i = 0; i < 100; ++i)
+    {
+        builder.append(reinterpret_cast<const byte *>("shell"), 5);
+        expected += "shell";
+    }
+    EXPECT_EQ(expected, static_cast<std::string>(builder));
+    EXPECT_EQ(512, builder.capacity()) << "The buffer should double when it is full!";
+    EXPECT_EQ(5, create_string("snail").capacity()) << "Other strings should not get spare room!";
+}
+
+TEST(ObjectTests, concatenationAliasingTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const string "a"
+        .const string "b"
+        .global s string
+        .global t string
+        .intrinsic println 1 void
+        .body
+            PUSH_CONST 0
+            PUSH_CONST 1
+            ADD
+            STORE_GLOBAL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            ADD
+            STORE_GLOBAL 1
+            PUSH_GLOBAL 0
+            PUSH_GLOBAL 0
+            ADD
+            STORE_GLOBAL 0
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 1
+            INTRINSIC_CALL 0
+            PUSH_CONST 0
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("abab\nabb\na\n", output.str()) << "Appending in place should not change strings linked elsewhere!";
+}
+
+TEST(ObjectTests, compareStringsTest)
+{
+    EXPECT_LT(create_string("snail").compare(create_string("snails")), 0);
+    EXPECT_GT(create_string("snail").compare(create_string("shell")), 0);
+    EXPECT_EQ(0, create_string("snail").compare(create_string("snail")));
+    EXPECT_EQ(0, create_string("").compare(create_string("")));
+}
+
+TEST(ObjectTests, compareArraysTest)
+{
+    Object apple = create_string("apple");
+    Object berry = create_string("berry");
+    Object first(Type::ARRAY, nullptr, 1);
+    Object second(Type::ARRAY, nullptr, 1);
+    // Link the elements in both orders of their addresses, the order of the arrays must not follow them
+    for (bool swapped : {false, true})
+    {
+        Object *element = swapped ? &berry : &apple;
+        reinterpret_cast<Link *>(first.data)[0] = element;
+        element = swapped ? &apple : &berry;
+        reinterpret_cast<Link *>(second.data)[0] = element;
+        EXPECT_EQ(!swapped, first < second);
+        EXPECT_EQ(swapped, first > second);
+    }
+}
+
+TEST(ObjectTests, internTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const string "snail"
+        .const string "sn"
+        .const string "ail"
+        .const string "snail"
+        .intrinsic intern 1 string
+        .intrinsic println 1 void
+        .body
+            PUSH_CONST 1
+            PUSH_CONST 2
+            ADD
+            DUP
+            PUSH_CONST 0
+            EQ
+            INTRINSIC_CALL 1
+            INTRINSIC_CALL 0
+            PUSH_CONST 0
+            EQ
+            INTRINSIC_CALL 1
+            PUSH_CONST 1
+            PUSH_CONST 0
+            LT
+            INTRINSIC_CALL 1
+        .end
+    )")));
+    EXPECT_EQ(env.constant_pool.data[0], env.constant_pool.data[3]) << "Equal constants should share one object!";
+    EXPECT_EQ(3, env.strings.size());
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("1\n1\n1\n", output.str());
+}
+
+TEST(ObjectTests, typedArrayTest)
+{
+    vm::Environment env(vm::load_image(vm::code::assemble(R"(
+        .const i32 -7
+        .const usize 1
+        .const usize 2
+        .const string "snail"
+        .global numbers array i32 3
+        .intrinsic println 1 void
+        .body
+            NEW_ARRAY 3 i32
+            PUSH_CONST 1
+            PUSH_CONST 0
+            INIT_ARRAY 2
+            STORE_GLOBAL 0
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 1
+            GET_ARRAY
+            INTRINSIC_CALL 0
+            PUSH_GLOBAL 0
+            PUSH_CONST 3
+            PUSH_CONST 2
+            SET_ARRAY
+            PUSH_GLOBAL 0
+            INTRINSIC_CALL 0
+        .end
+    )")));
+    std::ostringstream output;
+    env.output = &output;
+    vm::run(env, false);
+    EXPECT_EQ("[-7, 1, 0]\n1\n[-7, 1, snail]\n", output.str()) << "A typed array should box its elements when it gets a string!";
+    EXPECT_EQ(Type::VOID, env.global.variables[0].object->element);
+
+    Object numbers(1000, Type::I32);
+    EXPECT_EQ(4000, numbers.capacity()) << "Typed arrays should store raw elements!";
+    EXPECT_EQ(false, static_cast<bool>(numbers));
+}
+
+TEST(ObjectTests, largeArrayTest)
+{
+    const std::size_t size = 64 * 1024 * 1024;
+    Object links(size, Type::VOID);
+    Object numbers(size, Type::I32);
+    EXPECT_EQ(nullptr, reinterpret_cast<Link *>(links.data)[size - 1].object) << "Large arrays should start empty!";
+    reinterpret_cast<u32 *>(numbers.data)[size / 2] = 7;
+
+    // Only the page that was written to should be resident
+    long page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> pages(numbers.capacity() / page);
+    ASSERT_EQ(0, mincore(numbers.data, numbers.capacity(), pages.data()));
+    std::size_t resident = 0;
+    for (unsigned char state : pages)
+        resident += state & 1;
+    EXPECT_EQ(1, resident);
+    EXPECT_EQ(7, reinterpret_cast<u32 *>(numbers.data)[size / 2]);
+}
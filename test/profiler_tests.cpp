@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <csignal>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static const char *PROGRAM = R"(
+    .function run 0 void 0
+        RET
+    .end
+
+    .function walk 0 void 0
+        RET
+    .end
+
+    .body
+        CALL 0
+    .end
+)";
+
+// Samples are taken by raising SIGPROF on this thread with the timer off, so the stacks are known.
+// Stacks are written in the order of their packed frames
+TEST(ProfilerTests, collapsedTest)
+{
+    std::shared_ptr<Image> image = load_image(code::assemble(PROGRAM));
+    code::Reader reader = image->reader();
+    const code::Function &walk = image->functions.functions[1];
+    reader.set_offset(walk.offset + 1);
+
+    profile::start(0);
+    {
+        profile::CallGuard main(profile::MAIN_BODY, nullptr, 0x10, 0);
+        profile::CallGuard run(0, nullptr, 0x40, 0x18);
+        std::raise(SIGPROF);
+        std::raise(SIGPROF);
+        {
+            profile::CallGuard walking(1, &reader, walk.offset, 0x48);
+            std::raise(SIGPROF);
+        }
+        profile::CallGuard missing(7, nullptr, 0x80, 0x44);
+        std::raise(SIGPROF);
+    }
+    std::raise(SIGPROF);
+    profile::stop();
+
+    std::stringstream expected;
+    expected << "<main>@0x18;run@0x40 2\n"
+             << "<main>@0x18;run@0x44;func_7@0x80 1\n"
+             << "<main>@0x18;run@0x48;walk@0x" << std::hex << walk.offset + 1 << std::dec << " 1\n";
+    std::stringstream output;
+    profile::write_collapsed(output, image->functions);
+    EXPECT_EQ(expected.str(), output.str()) << "Interpreted leaves should be sampled at the offset of their reader!";
+}
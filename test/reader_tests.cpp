@@ -62,8 +62,9 @@ TEST_F(ReaderTestFixture, globalsTest)
     EXPECT_EQ(nullptr, globals.variables[1].object) << "Second global variable shouldn't be initialized here!";
 }
 
-static void test_function(const Function &function, std::size_t offset, Type return_type, byte arg_count, u16 local_count, u32 length)
+static void test_function(const Function &function, const std::string &name, std::size_t offset, Type return_type, byte arg_count, u16 local_count, u32 length)
 {
+    EXPECT_EQ(name, function.name) << "Function should be named '" << name << "'!";
     EXPECT_EQ(offset, function.offset) << "Function should have offset " << std::hex << offset << "!";
     EXPECT_EQ(return_type, function.return_type) << "Function should return type " << static_cast<int>(return_type) << "!";
     EXPECT_EQ(arg_count, function.arg_count) << "Function should have " << static_cast<int>(arg_count) << " arguments!";
@@ -78,8 +79,8 @@ TEST_F(ReaderTestFixture, functionsTest)
     reader.read_globals();
     FunctionTable functions = reader.read_functions();
     ASSERT_EQ(2U, functions.size);
-    test_function(functions.functions[0], 0x0000006C, Type::I32, 2, 4, 30);
-    test_function(functions.functions[1], 0x00000097, Type::VOID, 0, 4, 181);
+    test_function(functions.functions[0], "computeSum", 0x0000006C, Type::I32, 2, 4, 30);
+    test_function(functions.functions[1], "main", 0x00000097, Type::VOID, 0, 4, 181);
 }
 
 static void test_intrinsic(const Intrinsic &intrinsic, Type return_type, byte arg_count, const std::string &name)
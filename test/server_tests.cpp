@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+TEST(ServerTests, requestTest)
+{
+    std::vector<byte> bytes = code::assemble(workload::generate("sum_loop", {{"n", 100}, {"print", 1}}));
+    fs::path program = fs::temp_directory_path() / "shellvm_server_sum.slime";
+    std::ofstream(program, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    fs::path socket = fs::temp_directory_path() / ("shellvm_server_" + std::to_string(getpid()) + ".sock");
+
+    server::Server server(socket);
+    server.preload(program);
+    std::thread serving([&server]
+                        { server.run(); });
+
+    for (int i = 0; i < 3; ++i)
+    {
+        std::stringstream output, errors;
+        EXPECT_EQ(EXIT_SUCCESS, server::request(socket, program, false, output, errors));
+        EXPECT_EQ("4950\n", output.str());
+        EXPECT_EQ("", errors.str());
+    }
+    std::stringstream output, errors;
+    EXPECT_EQ(EXIT_FAILURE, server::request(socket, fs::temp_directory_path() / "shellvm_server_missing.slime", false, output, errors));
+    EXPECT_NE(std::string::npos, errors.str().find("shellvm_server_missing.slime"));
+
+    server.stop();
+    serving.join();
+    EXPECT_EQ(1U, server.image_cache().loads()) << "The image should stay loaded between requests!";
+    EXPECT_EQ(3U, server.image_cache().hits());
+}
+
+namespace
+{
+    // Stands in for compiled code of the other mode, which no request may run
+    template <typename... Arguments>
+    void foreign_code(Arguments...)
+    {
+        throw std::runtime_error("Compiled code of the other mode was called");
+    }
+}
+
+TEST(ServerTests, debugRequestTest)
+{
+    std::vector<byte> bytes = code::assemble(workload::generate("fibonacci", {{"n", 8}, {"print", 1}}));
+    fs::path program = fs::temp_directory_path() / "shellvm_server_fib.slime";
+    std::ofstream(program, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    fs::path socket = fs::temp_directory_path() / ("shellvm_server_debug_" + std::to_string(getpid()) + ".sock");
+
+    server::Server server(socket);
+    std::shared_ptr<Image> image = server.preload(program);
+    std::thread serving([&server]
+                        { server.run(); });
+    void *foreign = reinterpret_cast<void *>(static_cast<proccess::jit_function *>(foreign_code));
+    auto plant = [&image](void *release, void *debug)
+    {
+        for (u16 i = 0; i < image->functions.size; ++i)
+        {
+            image->functions.functions[i].compiled.store(release);
+            image->functions.functions[i].compiled_debug.store(debug);
+        }
+    };
+
+    std::stringstream debug_output, debug_errors;
+    plant(foreign, nullptr);
+    EXPECT_EQ(EXIT_SUCCESS, server::request(socket, program, true, debug_output, debug_errors)) << debug_errors.str();
+    EXPECT_NE(std::string::npos, debug_output.str().find("21\n")) << "A debug request should not run code compiled for a normal one!";
+
+    std::stringstream output, errors;
+    plant(nullptr, foreign);
+    EXPECT_EQ(EXIT_SUCCESS, server::request(socket, program, false, output, errors)) << errors.str();
+    EXPECT_EQ("21\n", output.str()) << "A normal request should not run code compiled for a debug one!";
+    plant(nullptr, nullptr);
+
+    server.stop();
+    serving.join();
+}
+
+TEST(ServerTests, silentClientTest)
+{
+    fs::path socket = fs::temp_directory_path() / ("shellvm_server_silent_" + std::to_string(getpid()) + ".sock");
+    server::Server server(socket);
+    std::thread serving([&server]
+                        { server.run(); });
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socket.c_str());
+    int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(0, ::connect(client, reinterpret_cast<sockaddr *>(&address), sizeof(address)));
+
+    auto start = std::chrono::steady_clock::now();
+    server.stop();
+    serving.join();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5)) << "A client that sends nothing should not delay stopping!";
+    ::close(client);
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+static const char *PROGRAM = R"(
+    .const i32 0
+    .const i32 1
+    .const string "snail"
+    .global table array i32 2
+    .global count i32
+    .intrinsic snapshot 0 void
+    .intrinsic println 1 void
+
+    .body
+        NEW_ARRAY 2 i32
+        STORE_GLOBAL 0
+        PUSH_GLOBAL 0
+        PUSH_CONST 2
+        PUSH_CONST 0
+        SET_ARRAY
+        PUSH_GLOBAL 0
+        PUSH_CONST 1
+        PUSH_CONST 1
+        SET_ARRAY
+        PUSH_CONST 1
+        STORE_GLOBAL 1
+        INTRINSIC_CALL 0
+        PUSH_GLOBAL 0
+        INTRINSIC_CALL 1
+        PUSH_GLOBAL 1
+        INTRINSIC_CALL 1
+    .end
+)";
+
+TEST(SnapshotTests, restoreTest)
+{
+    std::shared_ptr<Image> image = load_image(code::assemble(PROGRAM));
+    fs::path file = fs::temp_directory_path() / "shellvm_snapshot_test.snap";
+
+    std::stringstream before, after, full;
+    {
+        Environment env(image);
+        env.output = &before;
+        snapshot::create(file, env, false);
+    }
+    EXPECT_EQ("", before.str()) << "Nothing after the snapshot point should run while creating it!";
+
+    Environment restored(image);
+    restored.output = &after;
+    std::size_t resume_offset = snapshot::restore(file, restored);
+    EXPECT_GT(resume_offset, image->body_offset);
+    run(restored, false, resume_offset);
+
+    Environment fresh(image);
+    fresh.output = &full;
+    run(fresh, false);
+    EXPECT_EQ(full.str(), after.str()) << "A restored run should continue where the snapshot was taken!";
+    EXPECT_EQ(3U, restored.allocator.size()) << "Only objects reachable from globals should be restored!";
+
+    Environment other(load_image(code::assemble(std::string(PROGRAM) + "\n.const i32 2\n")));
+    EXPECT_THROW(snapshot::restore(file, other), code::InvalidBytecodeException);
+
+    std::ifstream input(file, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    input.close();
+    fs::path damaged = fs::temp_directory_path() / "shellvm_snapshot_damaged.snap";
+    for (std::size_t size : {std::size_t{4}, contents.size() / 2, contents.size() - 1})
+    {
+        std::ofstream(damaged, std::ios::binary | std::ios::trunc).write(contents.data(), static_cast<std::streamsize>(size));
+        Environment truncated(image);
+        EXPECT_THROW(snapshot::restore(damaged, truncated), code::InvalidBytecodeException) << size << " bytes";
+    }
+    std::string corrupt = contents;
+    corrupt[0] = static_cast<char>(~corrupt[0]);
+    std::ofstream(damaged, std::ios::binary | std::ios::trunc).write(corrupt.data(), static_cast<std::streamsize>(corrupt.size()));
+    Environment magic(image);
+    EXPECT_THROW(snapshot::restore(damaged, magic), code::InvalidBytecodeException) << "A file without the magic should be rejected!";
+
+    fs::remove(file);
+    fs::remove(damaged);
+}
@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "vm.hpp"
+
+using namespace vm;
+
+TEST(StatsTests, histogramTest)
+{
+    stats::Histogram histogram;
+    histogram.record(std::chrono::nanoseconds(0));
+    histogram.record(std::chrono::nanoseconds(1));
+    histogram.record(std::chrono::nanoseconds(1000));
+    histogram.record(std::chrono::hours(1000));
+
+    EXPECT_EQ(1U, histogram.buckets[0].load()) << "Zero should land in the first bucket!";
+    EXPECT_EQ(1U, histogram.buckets[1].load()) << "One nanosecond should land below 2ns!";
+    EXPECT_EQ(1U, histogram.buckets[10].load()) << "1000ns should land below 1024ns!";
+    EXPECT_EQ(1U, histogram.buckets[stats::Histogram::BUCKETS - 1].load()) << "Huge durations should land in the last bucket!";
+    EXPECT_EQ(4U, histogram.count.load());
+    EXPECT_EQ(static_cast<std::uint64_t>(std::chrono::nanoseconds(std::chrono::hours(1000)).count()), histogram.max.load());
+}
+
+TEST(StatsTests, threadTotalsTest)
+{
+    std::uint64_t before = stats::local().allocations.load();
+    {
+        memory::Allocator allocator;
+        int value = 1;
+        allocator.create(runtime::Type::I32, reinterpret_cast<byte *>(&value), sizeof(int));
+        std::thread([]
+                    {
+                        memory::Allocator other;
+                        int value = 2;
+                        other.create(runtime::Type::I32, reinterpret_cast<byte *>(&value), sizeof(int));
+                    })
+            .join();
+    }
+    EXPECT_EQ(before + 1, stats::local().allocations.load()) << "Counters should be per thread!";
+
+    std::stringstream json;
+    stats::write_json(json);
+    EXPECT_NE(std::string::npos, json.str().find("\"allocations\": " + std::to_string(before + 2))) << "Totals should include exited threads!";
+}
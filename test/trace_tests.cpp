@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "vm.hpp"
+
+using namespace vm::debug;
+using namespace vm::runtime;
+using Command = vm::code::Command;
+
+TEST(TraceTests, formatTest)
+{
+    std::ostringstream output;
+    {
+        Tracer tracer(output);
+        tracer.record({0x10, Command::PUSH_CONST, 3, 1, Type::I32, -7});
+        tracer.record({0x13, Command::JMP, static_cast<u32>(-5), 1, Type::STRING, 4});
+        tracer.record({0x16, Command::POP, 0, 0, Type::VOID, 0});
+    }
+    EXPECT_EQ("10: PUSH_CONST 3 | stack 1 | top -7\n"
+              "13: JMP -5 | stack 1 | top string of 4\n"
+              "16: POP | stack 0\n",
+              output.str());
+}
+
+TEST(TraceTests, overflowTest)
+{
+    std::ostringstream output;
+    constexpr std::size_t count = 20000;
+    {
+        Tracer tracer(output);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            tracer.record({i, Command::DUP, 0, i, Type::I32, 0});
+        }
+        tracer.flush();
+        std::string lines = output.str();
+        EXPECT_EQ(count, static_cast<std::size_t>(std::count(lines.begin(), lines.end(), '\n')));
+    }
+}